@@ -5,7 +5,7 @@
  * Usage: hackbench [-pipe] <num groups> [process|thread] [loops]
  *
  * Build it with:
- *   gcc -g -Wall -O2 -o hackbench hackbench.c -lpthread
+ *   gcc -g -Wall -O2 -D_GNU_SOURCE -I../include -o hackbench hackbench.c ../lib/rt-hist.c ../lib/rt-utils.c ../lib/error.c -lpthread -lm
  *
  * Downloaded from http://people.redhat.com/mingo/cfs-scheduler/tools/hackbench.c
  * February 19 2010.
@@ -23,18 +23,44 @@
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/poll.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <ctype.h>
 #include <limits.h>
 #include <getopt.h>
 #include <signal.h>
 #include <setjmp.h>
 #include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include "rt-hist.h"
+#include "rt-utils.h"
 
 static unsigned int datasize = 100;
 static unsigned int loops = 100;
 static unsigned int num_groups = 10;
 static unsigned int num_fds = 20;
 static unsigned int fifo = 0;
+static unsigned int histogram = 0;
+static unsigned int duration = 0;	/* seconds, instead of loops */
+static unsigned int rate = 0;		/* messages per second and group */
+static unsigned int interval = 0;	/* seconds between reports */
+static uint64_t pace_ns;		/* between two messages of a sender */
+static unsigned int runs = 1;		/* measured rounds */
+static unsigned int warmup = 0;		/* rounds before those */
 
 /*
  * 0 means thread mode and others mean process (default)
@@ -44,12 +70,77 @@ static unsigned int fifo = 0;
 
 static unsigned int process_mode = PROCESS_MODE;
 
-static int use_pipes = 0;
+/* How senders and receivers are connected */
+enum {
+	TRANSPORT_SOCKET,
+	TRANSPORT_PIPE,
+	TRANSPORT_RING,
+	TRANSPORT_DGRAM,
+	TRANSPORT_SEQPACKET,
+	TRANSPORT_TCP,
+	TRANSPORT_UDP,
+	TRANSPORT_NUM
+};
+
+static char *transport_names[] = {
+	[TRANSPORT_SOCKET] = "socket",
+	[TRANSPORT_PIPE] = "pipe",
+	[TRANSPORT_RING] = "ring",
+	[TRANSPORT_DGRAM] = "dgram",
+	[TRANSPORT_SEQPACKET] = "seqpacket",
+	[TRANSPORT_TCP] = "tcp",
+	[TRANSPORT_UDP] = "udp",
+};
+
+/* The largest message of the transports that keep message boundaries */
+#define DGRAM_MAX 65507
+
+static int transport = TRANSPORT_SOCKET;
+static int zerocopy = 0;
+static int tcp_listener = -1;
+
+/* How receivers wait for messages, and how many there are per group */
+enum {
+	EVENT_NONE,		/* one receiver blocks in read() per fd */
+	EVENT_EPOLL,
+	EVENT_URING,
+};
+
+static int event_mode = EVENT_NONE;
+static unsigned int num_receivers = 0;
+
+/* Where the groups run */
+enum {
+	PLACE_NONE,		/* wherever the scheduler puts them */
+	PLACE_CORE,
+	PLACE_LLC,
+	PLACE_NODE,
+	PLACE_SPREAD,
+	PLACE_NUM
+};
+
+static int placement = PLACE_NONE;
+
+/* Per receiver latency histograms, shared with forked receivers */
+static struct rt_hist *hist_tab;
+static size_t hist_tab_size;
+
+/* Messages received per fd, for the reports of -i and -D */
+struct msg_count {
+	volatile uint64_t msgs;
+} __attribute__((aligned(64)));
+
+static struct msg_count *count_tab;
+static size_t count_tab_size;
 
 struct sender_context {
 	unsigned int num_fds;
+	unsigned int first;		/* receiver, with -t ring */
+	unsigned int num;		/* of the sender in its group */
+	char *data;
 	int ready_out;
-	int wakefd;
+	int *wakefds;
+	struct zc_sock *zc_socks;
 	int out_fds[0];
 };
 
@@ -57,7 +148,13 @@ struct receiver_context {
 	unsigned int num_packets;
 	int in_fds[2];
 	int ready_out;
-	int wakefd;
+	int *wakefds;
+	struct rt_hist *hist;
+	struct msg_count *count;
+	struct udp_window *window;
+	unsigned int ring;		/* with -t ring, receiver number */
+	unsigned int next_sender;
+	char *data;
 };
 
 
@@ -90,15 +187,158 @@ static void barf(const char *msg)
 
 static void print_usage_exit()
 {
-	printf("Usage: hackbench [-p|--pipe] [-s|--datasize <bytes>] [-l|--loops <num loops>]\n"
+	printf("Usage: hackbench [-p|--pipe]\n"
+	       "\t\t [-t|--transport <socket|pipe|ring|dgram|seqpacket|tcp|udp>]\n"
+	       "\t\t [-s|--datasize <bytes>] [-l|--loops <num loops>]\n"
 	       "\t\t [-g|--groups <num groups] [-f|--fds <num fds>]\n"
-	       "\t\t [-T|--threads] [-P|--process] [--help]\n");
+	       "\t\t [-T|--threads] [-P|--process] [-H|--histogram <usecs>]\n"
+	       "\t\t [-Z|--zerocopy] [-e|--event <epoll|io_uring>]\n"
+	       "\t\t [-r|--receivers <num receivers>]\n"
+	       "\t\t [-a|--affinity <none|core|llc|node|spread>]\n"
+	       "\t\t [-D|--duration <time>] [-R|--rate <msgs/s>]\n"
+	       "\t\t [-i|--interval <secs>] [-N|--runs <num>] [-W|--warmup <num>]\n"
+	       "\t\t [--help]\n");
 	exit(1);
 }
 
+static inline uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct rt_hist *receiver_hist(unsigned int num)
+{
+	return (struct rt_hist *) ((char *) hist_tab +
+				   num * rt_hist_size(histogram));
+}
+
+/*
+ * With -D, the receivers cannot know how many messages will come, so
+ * every sender ends with a message whose first 8 bytes are 0. Normal
+ * messages start with '-' or the send time of -H.
+ */
+static int end_marker(char *data)
+{
+	uint64_t val;
+
+	if (!duration)
+		return 0;
+	memcpy(&val, data, sizeof(val));
+	return val == 0;
+}
+
+static void count_msg(struct msg_count *count)
+{
+	if (count)
+		count->msgs++;
+}
+
+/*
+ * With -R, wait for the time of the next message. A sender that has
+ * fallen behind continues at the rate from now on, rather than making
+ * up for the lost messages in a burst.
+ */
+static void pace(uint64_t *next)
+{
+	uint64_t now = gettime_ns();
+	struct timespec ts;
+
+	if (*next + pace_ns < now)
+		*next = now;
+	else if (*next > now) {
+		ts.tv_sec = *next / 1000000000;
+		ts.tv_nsec = *next % 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR)
+			;
+	}
+	*next += pace_ns;
+}
+
+/* Receivers per group, with -e the rest of the group are senders */
+static unsigned int group_receivers(void)
+{
+	return event_mode == EVENT_NONE ? num_fds : num_receivers;
+}
+
+/*
+ * The contexts, message buffers and thread stacks of all workers come
+ * from an arena of shared memory. fork() does not copy the page tables
+ * of shared memory, every worker only touches its own part, and nothing
+ * is freed before the end of the run.
+ */
+#define ARENA_CHUNK	(1 << 20)
+#define ARENA_ALIGN	64
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+};
+
+static struct arena_chunk *arena;
+
+static void *arena_alloc(size_t size)
+{
+	struct arena_chunk *chunk = arena;
+	size_t head = (sizeof(*chunk) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	void *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (!chunk || chunk->used + size > chunk->size) {
+		size_t chunk_size = head + size > ARENA_CHUNK ?
+			head + size : ARENA_CHUNK;
+
+		chunk = mmap(NULL, chunk_size, PROT_READ|PROT_WRITE,
+			     MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if (chunk == MAP_FAILED)
+			return NULL;
+		chunk->next = arena;
+		chunk->size = chunk_size;
+		chunk->used = head;
+		arena = chunk;
+	}
+	p = (char *) chunk + chunk->used;
+	chunk->used += size;
+	return p;
+}
+
+/*
+ * A thread stack in the arena, page aligned with a PROT_NONE guard page
+ * below it, so that an overflow faults instead of writing into the
+ * contexts and buffers of other workers.
+ */
+static void *arena_alloc_stack(size_t size)
+{
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+	uintptr_t p;
+
+	size = (size + pagesize - 1) & ~(pagesize - 1);
+	p = (uintptr_t) arena_alloc(size + 2 * pagesize);
+	if (!p)
+		return NULL;
+	p = (p + pagesize - 1) & ~(pagesize - 1);
+	if (mprotect((void *) p, pagesize, PROT_NONE))
+		return NULL;
+	return (void *) (p + pagesize);
+}
+
+static void arena_free(void)
+{
+	while (arena) {
+		struct arena_chunk *next = arena->next;
+
+		munmap(arena, arena->size);
+		arena = next;
+	}
+}
+
 static void fdpair(int fds[2])
 {
-	if (use_pipes) {
+	if (transport == TRANSPORT_PIPE) {
 		if (pipe(fds) == 0)
 			return;
 	} else {
@@ -108,15 +348,117 @@ static void fdpair(int fds[2])
 	barf("Creating fdpair");
 }
 
-/* Block until we're ready to go */
-static void ready(int ready_out, int wakefd)
+/* A TCP connection over loopback, fds[0] is the accepted end */
+static void tcp_fdpair(int fds[2])
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int one = 1;
+
+	if (tcp_listener < 0) {
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		tcp_listener = socket(AF_INET, SOCK_STREAM, 0);
+		if (tcp_listener < 0 ||
+		    bind(tcp_listener, (struct sockaddr *) &addr, len) ||
+		    listen(tcp_listener, 1))
+			barf("Creating TCP listener");
+	}
+	if (getsockname(tcp_listener, (struct sockaddr *) &addr, &len))
+		barf("Creating TCP fdpair");
+	fds[1] = socket(AF_INET, SOCK_STREAM, 0);
+	if (fds[1] < 0 || connect(fds[1], (struct sockaddr *) &addr, len))
+		barf("Connecting TCP fdpair");
+	fds[0] = accept(tcp_listener, NULL, NULL);
+	if (fds[0] < 0)
+		barf("Accepting TCP fdpair");
+	if (setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+		barf("Setting TCP_NODELAY");
+	if (zerocopy &&
+	    setsockopt(fds[1], SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+		barf("Enabling SO_ZEROCOPY");
+}
+
+/*
+ * Loopback UDP drops what does not fit into the receive buffer, and a
+ * receiver would wait for lost messages forever. The senders of a
+ * receiver may have udp_window messages in flight, which take at most
+ * half of the buffer including the overhead of the sk_buffs.
+ */
+static unsigned int udp_window;
+
+/* Two UDP sockets over loopback connected to each other */
+static void udp_fdpair(int fds[2])
+{
+	struct sockaddr_in addr[2];
+	socklen_t len = sizeof(addr[0]);
+	int i, rcvbuf;
+
+	for (i = 0; i < 2; i++) {
+		memset(&addr[i], 0, len);
+		addr[i].sin_family = AF_INET;
+		addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		if (fds[i] < 0 ||
+		    bind(fds[i], (struct sockaddr *) &addr[i], len) ||
+		    getsockname(fds[i], (struct sockaddr *) &addr[i], &len))
+			barf("Creating UDP fdpair");
+	}
+	if (connect(fds[0], (struct sockaddr *) &addr[1], len) ||
+	    connect(fds[1], (struct sockaddr *) &addr[0], len))
+		barf("Connecting UDP fdpair");
+
+	len = sizeof(rcvbuf);
+	if (getsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len))
+		barf("Reading SO_RCVBUF");
+	udp_window = rcvbuf / 2 / (2 * datasize + 2048);
+	if (!udp_window)
+		udp_window = 1;
+}
+
+/* The fds between senders and receivers */
+static void data_fdpair(int fds[2])
+{
+	switch (transport) {
+	case TRANSPORT_DGRAM:
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds))
+			barf("Creating fdpair");
+		break;
+	case TRANSPORT_SEQPACKET:
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds))
+			barf("Creating fdpair");
+		break;
+	case TRANSPORT_TCP:
+		tcp_fdpair(fds);
+		break;
+	case TRANSPORT_UDP:
+		udp_fdpair(fds);
+		break;
+	default:
+		fdpair(fds);
+	}
+}
+
+/*
+ * Block until we're ready to go. The workers stay for all rounds of -N and
+ * -W, and the rounds take turns over two wake fds: main drains one while
+ * all workers wait on the other.
+ */
+static void tell_ready(int ready_out)
 {
 	char dummy = '*';
-	struct pollfd pollfd = { .fd = wakefd, .events = POLLIN };
 
-	/* Tell them we're ready. */
 	if (write(ready_out, &dummy, 1) != 1)
 		barf("CLIENT: ready write");
+}
+
+static void ready(int ready_out, int *wakefds, unsigned int round)
+{
+	struct pollfd pollfd = { .fd = wakefds[round & 1], .events = POLLIN };
+
+	/* Tell them we're ready. */
+	tell_ready(ready_out);
 
 	/* Wait for "GO" signal */
 	if (poll(&pollfd, 1, -1) != 1)
@@ -129,73 +471,1088 @@ static void reset_worker_signals(void)
 	signal(SIGINT, SIG_DFL);
 }
 
+/*
+ * The CPU time, context switches and migrations of all workers in the
+ * measured rounds. Every worker, process or thread, takes a sample of
+ * its own when the first measured round starts and adds the difference
+ * when it is done. The migrations come from /proc/thread-self/sched,
+ * which needs CONFIG_SCHED_DEBUG.
+ */
+struct worker_usage {
+	uint64_t user_us;
+	uint64_t sys_us;
+	uint64_t nvcsw;
+	uint64_t nivcsw;
+	uint64_t migrations;
+	int no_migrations;
+};
+
+static struct worker_usage *usage_total;	/* shared with the workers */
+
+static uint64_t timeval_us(struct timeval *tv)
+{
+	return (uint64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static void usage_sample(struct worker_usage *usage)
+{
+	unsigned long long migrations;
+	struct rusage ru;
+	char line[128];
+	FILE *f;
+
+	memset(usage, 0, sizeof(*usage));
+	if (getrusage(RUSAGE_THREAD, &ru))
+		barf("getrusage");
+	usage->user_us = timeval_us(&ru.ru_utime);
+	usage->sys_us = timeval_us(&ru.ru_stime);
+	usage->nvcsw = ru.ru_nvcsw;
+	usage->nivcsw = ru.ru_nivcsw;
+
+	usage->no_migrations = 1;
+	f = fopen("/proc/thread-self/sched", "r");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "se.nr_migrations : %llu", &migrations) == 1) {
+			usage->migrations = migrations;
+			usage->no_migrations = 0;
+			break;
+		}
+	fclose(f);
+}
+
+static void usage_add(struct worker_usage *start)
+{
+	struct worker_usage now;
+
+	usage_sample(&now);
+	__atomic_fetch_add(&usage_total->user_us,
+			   now.user_us - start->user_us, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&usage_total->sys_us,
+			   now.sys_us - start->sys_us, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&usage_total->nvcsw,
+			   now.nvcsw - start->nvcsw, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&usage_total->nivcsw,
+			   now.nivcsw - start->nivcsw, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&usage_total->migrations,
+			   now.migrations - start->migrations,
+			   __ATOMIC_RELAXED);
+	if (start->no_migrations || now.no_migrations)
+		usage_total->no_migrations = 1;
+}
+
+/*
+ * With -Z, the kernel refers to a message in place until it has been
+ * delivered, so every sender keeps ZC_SLOTS message buffers per fd and
+ * writes the send time of -H into a buffer only when it is free again.
+ * A pipe holds at most 16 buffers by default, so a buffer is free again
+ * ZC_SLOTS messages later. A buffer sent with MSG_ZEROCOPY is free once
+ * the completion of its send has been read from the error queue.
+ *
+ * Messages up to a page do not straddle a page boundary, so vmsplice()
+ * puts them into a single pipe buffer and messages of different senders
+ * do not interleave, like write()s up to PIPE_BUF.
+ */
+#define ZC_SLOTS 32
+
+/*
+ * All senders of a group write to the same sockets, and the kernel counts
+ * the MSG_ZEROCOPY sends per socket. The senders share the count, and
+ * whoever reads a completion from the error queue updates it for all.
+ */
+struct zc_sock {
+	pthread_mutex_t lock;
+	uint32_t next;			/* id of the next MSG_ZEROCOPY send */
+	uint32_t done;			/* all sends below have completed */
+};
+
+struct zc_state {
+	char *buf;
+	size_t slot_size;
+	unsigned int slots_per_page;
+	uint32_t slot_id[ZC_SLOTS];	/* send id + 1 of the buffer */
+	uint32_t last;			/* send id + 1 of the last message */
+	unsigned int seq;
+};
+
+static struct zc_sock *zc_sock_tab;
+static size_t zc_sock_tab_size;
+
+static void zc_init(struct zc_state *zc)
+{
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+	size_t size;
+
+	if (datasize <= pagesize) {
+		zc->slots_per_page = pagesize / datasize;
+		zc->slot_size = datasize;
+		size = (ZC_SLOTS + zc->slots_per_page - 1) /
+			zc->slots_per_page * pagesize;
+	} else {
+		zc->slots_per_page = 1;
+		zc->slot_size = (datasize + pagesize - 1) / pagesize * pagesize;
+		size = ZC_SLOTS * zc->slot_size;
+	}
+	if (posix_memalign((void **) &zc->buf, pagesize, size))
+		barf("SENDER: malloc() [zerocopy]");
+	memset(zc->buf, '-', size);
+}
+
+static char *zc_slot(struct zc_state *zc, unsigned int slot)
+{
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+
+	if (zc->slots_per_page == 1)
+		return zc->buf + slot * zc->slot_size;
+	return zc->buf + slot / zc->slots_per_page * pagesize +
+		slot % zc->slots_per_page * zc->slot_size;
+}
+
+static int zc_done(struct zc_sock *sock, uint32_t id)
+{
+	int done;
+
+	pthread_mutex_lock(&sock->lock);
+	done = (int32_t) (sock->done - id) >= 0;
+	pthread_mutex_unlock(&sock->lock);
+	return done;
+}
+
+/* Read MSG_ZEROCOPY completions, if there are any */
+static void zc_reap(int fd, struct zc_sock *sock)
+{
+	char control[128];
+	struct pollfd pollfd = { .fd = fd, .events = 0 };
+	struct msghdr msg;
+	struct cmsghdr *cm;
+
+	/* Another sender may read the completion we wait for */
+	if (poll(&pollfd, 1, 10) < 0)
+		barf("SENDER: poll");
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+		if (errno == EAGAIN)
+			return;
+		barf("SENDER: recvmsg(MSG_ERRQUEUE)");
+	}
+	for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+		struct sock_extended_err *serr = (void *) CMSG_DATA(cm);
+
+		if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+			continue;
+		if (serr->ee_errno != 0) {
+			errno = serr->ee_errno;
+			barf("SENDER: zerocopy completion");
+		}
+		/* [ee_info, ee_data] have completed, TCP completes in order */
+		pthread_mutex_lock(&sock->lock);
+		if ((int32_t) (serr->ee_data + 1 - sock->done) > 0)
+			sock->done = serr->ee_data + 1;
+		pthread_mutex_unlock(&sock->lock);
+	}
+}
+
+/* Send one message with vmsplice() to a pipe or MSG_ZEROCOPY to a socket */
+static void zc_send(int fd, struct zc_sock *sock, pthread_mutex_t *send_lock,
+		    struct zc_state *zc)
+{
+	unsigned int slot = zc->seq++ % ZC_SLOTS;
+	char *data = zc_slot(zc, slot);
+	struct iovec iov = { .iov_base = data, .iov_len = datasize };
+	ssize_t ret;
+
+	if (histogram) {
+		uint64_t now;
+
+		if (transport != TRANSPORT_PIPE)
+			while (zc->slot_id[slot] && !zc_done(sock,
+							     zc->slot_id[slot]))
+				zc_reap(fd, sock);
+		now = gettime_ns();
+		memcpy(data, &now, sizeof(now));
+	}
+
+	if (send_lock)
+		pthread_mutex_lock(send_lock);
+	while (iov.iov_len > 0) {
+		if (transport == TRANSPORT_PIPE) {
+			ret = vmsplice(fd, &iov, 1, 0);
+			if (ret < 0)
+				barf("SENDER: vmsplice");
+		} else {
+			struct msghdr msg;
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			pthread_mutex_lock(&sock->lock);
+			ret = sendmsg(fd, &msg, MSG_ZEROCOPY);
+			if (ret >= 0)
+				zc->last = ++sock->next;
+			pthread_mutex_unlock(&sock->lock);
+			if (ret < 0 && errno == ENOBUFS) {
+				/* Too many completions queued up */
+				zc_reap(fd, sock);
+				continue;
+			}
+			if (ret < 0)
+				barf("SENDER: sendmsg(MSG_ZEROCOPY)");
+		}
+		iov.iov_base = (char *) iov.iov_base + ret;
+		iov.iov_len -= ret;
+	}
+	if (send_lock)
+		pthread_mutex_unlock(send_lock);
+	zc->slot_id[slot] = zc->last;
+}
+
+static void write_msg(int fd, char *data)
+{
+	int ret, done = 0;
+
+	while (done < datasize) {
+		ret = write(fd, data + done, datasize - done);
+		if (ret < 0)
+			barf("SENDER: write");
+		done += ret;
+	}
+}
+
+/*
+ * With -t ring, every sender and receiver share a ring of RING_SLOTS
+ * messages in shared memory, and messages pass without a system call.
+ * A receiver that finds all of its rings empty sleeps on a futex of its
+ * own, and the senders only ring that doorbell while it sleeps. A sender
+ * waits the same way for a slot in a full ring. A pipe holds 16 messages
+ * by default.
+ */
+#define RING_SLOTS 16
+
+struct ring_bell {
+	uint32_t seq;			/* the futex */
+	uint32_t waiting;
+} __attribute__((aligned(64)));
+
+struct shm_ring {
+	uint32_t head __attribute__((aligned(64)));	/* receiver */
+	uint32_t tail __attribute__((aligned(64)));	/* sender */
+	struct ring_bell space;
+	char slots[0] __attribute__((aligned(64)));
+};
+
+/* The rings of receiver r are those of all senders of its group in a row */
+static char *ring_tab;
+static size_t ring_size, ring_tab_size;
+static struct ring_bell *bell_tab;
+
+static struct shm_ring *ring_at(unsigned int receiver, unsigned int sender)
+{
+	return (struct shm_ring *) (ring_tab +
+				    (receiver * num_fds + sender) * ring_size);
+}
+
+static void futex_wait(uint32_t *addr, uint32_t val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Sleep until ready() holds or the bell rings. The other side changes
+ * the ring before it looks at waiting, and we look at the ring after we
+ * have counted ourselves in waiting, so one of us sees the other. The
+ * senders of -t udp share a bell, which wakes all of them.
+ */
+static void bell_wait(struct ring_bell *bell, int (*ready)(void *), void *arg)
+{
+	uint32_t seq = __atomic_load_n(&bell->seq, __ATOMIC_ACQUIRE);
+
+	__atomic_fetch_add(&bell->waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!ready(arg))
+		futex_wait(&bell->seq, seq);
+	__atomic_fetch_sub(&bell->waiting, 1, __ATOMIC_RELAXED);
+}
+
+static void bell_ring(struct ring_bell *bell)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&bell->waiting, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(&bell->seq, 1, __ATOMIC_RELEASE);
+		futex_wake(&bell->seq);
+	}
+}
+
+static int ring_has_space(void *arg)
+{
+	struct shm_ring *ring = arg;
+
+	return ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) <
+		RING_SLOTS;
+}
+
+static void ring_send(struct shm_ring *ring, struct ring_bell *bell,
+		      char *data)
+{
+	uint32_t tail = ring->tail;
+
+	while (!ring_has_space(ring))
+		bell_wait(&ring->space, ring_has_space, ring);
+	memcpy(ring->slots + tail % RING_SLOTS * datasize, data, datasize);
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	bell_ring(bell);
+}
+
+/*
+ * With -t udp, the senders take a ticket for every message and wait
+ * until the receiver has read all but udp_window of the messages before.
+ */
+struct udp_window {
+	uint32_t sent __attribute__((aligned(64)));	/* senders */
+	uint32_t done __attribute__((aligned(64)));	/* receiver */
+	struct ring_bell space;
+};
+
+struct udp_ticket {
+	struct udp_window *window;
+	uint32_t ticket;
+};
+
+static struct udp_window *window_tab;
+static size_t window_tab_size;
+
+/*
+ * A stream may take a large write in several pieces, and the messages of
+ * the senders sharing a receiver's fd would interleave: a pipe above
+ * PIPE_BUF, an AF_UNIX stream socket above what fits into one skb, and
+ * TCP whenever tcp_sendmsg() lets go of the socket. The receiver only
+ * counts bytes, but the send times of -H must arrive whole. With -t tcp,
+ * and with -H on a socket or pipe, the senders of a receiver take turns
+ * with whole messages.
+ */
+static pthread_mutex_t *send_lock_tab;
+static size_t send_lock_tab_size;
+
+static int window_open(void *arg)
+{
+	struct udp_ticket *t = arg;
+
+	/* The others may have passed a ticket that was taken long ago */
+	return (int32_t) (t->ticket - __atomic_load_n(&t->window->done,
+						      __ATOMIC_ACQUIRE)) <
+		(int32_t) udp_window;
+}
+
+static void window_take(struct udp_window *window)
+{
+	struct udp_ticket t = {
+		.window = window,
+		.ticket = __atomic_fetch_add(&window->sent, 1, __ATOMIC_RELAXED),
+	};
+
+	while (!window_open(&t))
+		bell_wait(&window->space, window_open, &t);
+}
+
+static void window_put(struct udp_window *window)
+{
+	if (!window)
+		return;
+	__atomic_store_n(&window->done, window->done + 1, __ATOMIC_RELEASE);
+	bell_ring(&window->space);
+}
+
+static void send_msg(struct sender_context *ctx, unsigned int j, char *data)
+{
+	if (transport == TRANSPORT_RING) {
+		ring_send(ring_at(ctx->first + j, ctx->num),
+			  &bell_tab[ctx->first + j], data);
+		return;
+	}
+	if (window_tab)
+		window_take(&window_tab[ctx->first + j]);
+	if (send_lock_tab) {
+		pthread_mutex_lock(&send_lock_tab[ctx->first + j]);
+		write_msg(ctx->out_fds[j], data);
+		pthread_mutex_unlock(&send_lock_tab[ctx->first + j]);
+	} else
+		write_msg(ctx->out_fds[j], data);
+}
+
 /* Sender sprays loops messages down each file descriptor */
 static void *sender(struct sender_context *ctx)
 {
-	char data[datasize];
-	unsigned int i, j;
+	char *data = ctx->data;
+	struct zc_state *zc = NULL;
+	struct worker_usage usage;
+	uint64_t next = 0, end = 0;
+	unsigned int i, j, round;
 
 	reset_worker_signals();
-	ready(ctx->ready_out, ctx->wakefd);
-	memset(&data, '-', datasize);
+	if (zerocopy) {
+		zc = calloc(ctx->num_fds, sizeof(*zc));
+		if (!zc)
+			barf("SENDER: malloc() [zerocopy]");
+		for (j = 0; j < ctx->num_fds; j++)
+			zc_init(&zc[j]);
+	}
 
-	/* Now pump to every receiver. */
-	for (i = 0; i < loops; i++) {
-		for (j = 0; j < ctx->num_fds; j++) {
-			int ret, done = 0;
+	for (round = 0; round < warmup + runs; round++) {
+		ready(ctx->ready_out, ctx->wakefds, round);
+		if (round == warmup)
+			usage_sample(&usage);
+		memset(data, '-', datasize);
+		next = gettime_ns();
+		end = next + (uint64_t) duration * 1000000000;
+
+		/* Now pump to every receiver. */
+		for (i = 0; duration ? gettime_ns() < end : i < loops; i++) {
+			for (j = 0; j < ctx->num_fds; j++) {
+				if (rate)
+					pace(&next);
+				if (zerocopy) {
+					zc_send(ctx->out_fds[j], ctx->zc_socks ?
+						&ctx->zc_socks[j] : NULL,
+						send_lock_tab ?
+						&send_lock_tab[ctx->first + j] :
+						NULL, &zc[j]);
+					continue;
+				}
+
+				/* With -H, every message carries its send time */
+				if (histogram) {
+					uint64_t now = gettime_ns();
+
+					memcpy(data, &now, sizeof(now));
+				}
+				send_msg(ctx, j, data);
+			}
+		}
 
-again:
-			ret = write(ctx->out_fds[j], data + done, sizeof(data)-done);
-			if (ret < 0)
-				barf("SENDER: write");
-			done += ret;
-			if (done < sizeof(data))
-				goto again;
+		if (duration) {
+			memset(data, 0, sizeof(uint64_t));
+			for (j = 0; j < ctx->num_fds; j++)
+				send_msg(ctx, j, data);
+		}
+	}
+	/* The last round ends here, not when we have exited */
+	tell_ready(ctx->ready_out);
+
+	/*
+	 * The buffers must stay in place until the last send has completed,
+	 * a pipe refers to them until they have been read.
+	 */
+	if (zerocopy) {
+		for (j = 0; j < ctx->num_fds; j++) {
+			int left;
+
+			if (ctx->zc_socks)
+				while (zc[j].last &&
+				       !zc_done(&ctx->zc_socks[j], zc[j].last))
+					zc_reap(ctx->out_fds[j],
+						&ctx->zc_socks[j]);
+			else
+				while (!ioctl(ctx->out_fds[j], FIONREAD, &left) &&
+				       left > 0)
+					usleep(1000);
+			free(zc[j].buf);
 		}
+		free(zc);
 	}
 
+	usage_add(&usage);
 	return NULL;
 }
 
 
+static int ring_not_empty(void *arg)
+{
+	struct receiver_context *ctx = arg;
+	unsigned int i;
+
+	for (i = 0; i < num_fds; i++) {
+		struct shm_ring *ring = ring_at(ctx->ring, i);
+
+		if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != ring->head)
+			return 1;
+	}
+	return 0;
+}
+
+/* Take the next message from the rings of all senders, round robin */
+static void ring_recv(struct receiver_context *ctx, char *data)
+{
+	unsigned int i;
+
+	for (;;) {
+		for (i = 0; i < num_fds; i++) {
+			unsigned int sender = (ctx->next_sender + i) % num_fds;
+			struct shm_ring *ring = ring_at(ctx->ring, sender);
+			uint32_t head = ring->head;
+
+			if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head)
+				continue;
+			memcpy(data, ring->slots + head % RING_SLOTS * datasize,
+			       datasize);
+			__atomic_store_n(&ring->head, head + 1,
+					 __ATOMIC_RELEASE);
+			bell_ring(&ring->space);
+			ctx->next_sender = (sender + 1) % num_fds;
+			return;
+		}
+		bell_wait(&bell_tab[ctx->ring], ring_not_empty, ctx);
+	}
+}
+
 /* One receiver per fd */
 static void *receiver(struct receiver_context* ctx)
 {
-	unsigned int i;
+	unsigned int i, round, copy = datasize;
+	struct worker_usage usage;
+	int devnull = -1;
 
 	reset_worker_signals();
-	if (process_mode == PROCESS_MODE)
+	if (process_mode == PROCESS_MODE && transport != TRANSPORT_RING)
 		close(ctx->in_fds[1]);
 
-	/* Wait for start... */
-	ready(ctx->ready_out, ctx->wakefd);
+	/*
+	 * With -Z on pipes, only the send time is read, the rest of a
+	 * message is spliced to /dev/null without being copied.
+	 */
+	if (zerocopy && transport == TRANSPORT_PIPE) {
+		copy = histogram || duration ? sizeof(uint64_t) : 0;
+		devnull = open("/dev/null", O_WRONLY);
+		if (devnull < 0)
+			barf("SERVER: open /dev/null");
+	}
 
-	/* Receive them all */
-	for (i = 0; i < ctx->num_packets; i++) {
-		char data[datasize];
-		int ret, done = 0;
+	for (round = 0; round < warmup + runs; round++) {
+		/* The warmup rounds do not count for -H */
+		struct rt_hist *hist = round >= warmup ? ctx->hist : NULL;
 
-again:
-		ret = read(ctx->in_fds[0], data + done, datasize - done);
-		if (ret < 0)
-			barf("SERVER: read");
-		done += ret;
-		if (done < datasize)
-			goto again;
+		/* Wait for start... */
+		ready(ctx->ready_out, ctx->wakefds, round);
+		if (round == warmup)
+			usage_sample(&usage);
+
+		/* Receive them all, or with -D until every sender is done */
+		for (i = 0; i < ctx->num_packets; ) {
+			char *data = ctx->data;
+			int ret, done = 0;
+
+			if (transport == TRANSPORT_RING) {
+				ring_recv(ctx, data);
+				done = datasize;
+			}
+			while (done < copy) {
+				ret = read(ctx->in_fds[0], data + done, copy - done);
+				if (ret < 0)
+					barf("SERVER: read");
+				done += ret;
+			}
+			while (done < datasize) {
+				ret = splice(ctx->in_fds[0], NULL, devnull, NULL,
+					     datasize - done, SPLICE_F_MOVE);
+				if (ret <= 0)
+					barf("SERVER: splice");
+				done += ret;
+			}
+			window_put(ctx->window);
+
+			if (end_marker(data)) {
+				i++;
+				continue;
+			}
+			if (!duration)
+				i++;
+			count_msg(ctx->count);
+			if (hist) {
+				uint64_t sent;
+
+				memcpy(&sent, data, sizeof(sent));
+				rt_hist_add(hist, histogram,
+					    (gettime_ns() - sent) / 1000);
+			}
+		}
+	}
+	tell_ready(ctx->ready_out);
+	if (devnull >= 0)
+		close(devnull);
+	usage_add(&usage);
+	return NULL;
+}
+
+/*
+ * With -e, a few receivers per group multiplex all fds of the group, like
+ * the threads of an event loop. The fds are dealt out round robin, and a
+ * receiver collects the messages of each fd from as many reads as it takes.
+ */
+struct event_fd {
+	int fd;
+	unsigned int left;		/* messages, or senders with -D */
+	unsigned int done;		/* bytes of the current message */
+	struct rt_hist *hist;
+	struct msg_count *count;
+	struct udp_window *window;
+	char *data;
+};
+
+struct event_context {
+	unsigned int num_fds;
+	unsigned int num_packets;	/* per fd and round */
+	int ready_out;
+	int *wakefds;
+	struct event_fd efds[0];
+};
+
+/* Account for ret bytes read, return 1 once all messages have arrived */
+static int event_consume(struct event_fd *efd, int ret, int measure)
+{
+	if (ret == 0) {
+		errno = EPIPE;
+		barf("SERVER: unexpected EOF");
+	}
+	efd->done += ret;
+	if (efd->done < datasize)
+		return 0;
+
+	efd->done = 0;
+	window_put(efd->window);
+	if (end_marker(efd->data))
+		return --efd->left == 0;
+	count_msg(efd->count);
+	if (histogram && measure) {
+		uint64_t sent;
+
+		memcpy(&sent, efd->data, sizeof(sent));
+		rt_hist_add(efd->hist, histogram, (gettime_ns() - sent) / 1000);
+	}
+	return !duration && --efd->left == 0;
+}
+
+static int epoll_setup(struct event_context *ctx)
+{
+	unsigned int i;
+	int epfd;
+
+	epfd = epoll_create1(0);
+	if (epfd < 0)
+		barf("SERVER: epoll_create1");
+	for (i = 0; i < ctx->num_fds; i++) {
+		int fd = ctx->efds[i].fd;
+
+		if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK))
+			barf("SERVER: fcntl");
+	}
+	return epfd;
+}
+
+/* Watch all fds for a round, each leaves the set when it is done */
+static void epoll_arm(struct event_context *ctx, int epfd)
+{
+	struct epoll_event ev;
+	unsigned int i;
+
+	for (i = 0; i < ctx->num_fds; i++) {
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, ctx->efds[i].fd, &ev))
+			barf("SERVER: epoll_ctl");
+	}
+}
+
+/* Events per epoll_wait(), on the small stack of a worker thread */
+#define EPOLL_BATCH 64
+
+static void epoll_receive(struct event_context *ctx, int epfd, int measure)
+{
+	struct epoll_event events[EPOLL_BATCH];
+	unsigned int i, active = ctx->num_fds;
+	int n;
+
+	while (active) {
+		n = epoll_wait(epfd, events, EPOLL_BATCH, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			barf("SERVER: epoll_wait");
+		}
+		for (i = 0; i < n; i++) {
+			struct event_fd *efd = &ctx->efds[events[i].data.u32];
+			int ret;
+
+			/* Drain the fd, it stays ready as long as there is data */
+			for (;;) {
+				ret = read(efd->fd, efd->data + efd->done,
+					   datasize - efd->done);
+				if (ret < 0 && errno == EAGAIN)
+					break;
+				if (ret < 0)
+					barf("SERVER: read");
+				if (event_consume(efd, ret, measure)) {
+					/* Do not wake up for EOF */
+					epoll_ctl(epfd, EPOLL_CTL_DEL, efd->fd,
+						  NULL);
+					active--;
+					break;
+				}
+			}
+		}
 	}
-	if (ctx) {
-		free(ctx);
+}
+
+/*
+ * A bare io_uring, set up with the system calls instead of liburing, so
+ * that hackbench does not need another library.
+ */
+struct uring {
+	int fd;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned int queued;
+	void *sq, *cq;
+	size_t sq_size, cq_size, sqes_size;
+};
+
+static void uring_init(struct uring *ring, unsigned int entries)
+{
+	struct io_uring_params p;
+	size_t sq_size, cq_size;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		barf("SERVER: io_uring_setup");
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP && cq_size > sq_size)
+		sq_size = cq_size;
+	sq = mmap(NULL, sq_size, PROT_READ|PROT_WRITE,
+		  MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		barf("SERVER: mmap() [io_uring]");
+	cq = sq;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		cq = mmap(NULL, cq_size, PROT_READ|PROT_WRITE,
+			  MAP_SHARED|MAP_POPULATE, ring->fd,
+			  IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			barf("SERVER: mmap() [io_uring]");
+	}
+	ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+			  PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+			  ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		barf("SERVER: mmap() [io_uring]");
+
+	ring->sq_head = (unsigned int *) (sq + p.sq_off.head);
+	ring->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *) (sq + p.sq_off.array);
+	ring->cq_head = (unsigned int *) (cq + p.cq_off.head);
+	ring->cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+	ring->queued = 0;
+	ring->sq = sq;
+	ring->cq = cq;
+	ring->sq_size = sq_size;
+	ring->cq_size = cq_size;
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+}
+
+static void uring_exit(struct uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq != ring->sq)
+		munmap(ring->cq, ring->cq_size);
+	munmap(ring->sq, ring->sq_size);
+	close(ring->fd);
+}
+
+/* Queue a read of the rest of the current message */
+static void uring_queue_read(struct uring *ring, struct event_fd *efd,
+			     unsigned int num)
+{
+	unsigned int tail = *ring->sq_tail;
+	unsigned int index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = efd->fd;
+	sqe->addr = (uintptr_t) (efd->data + efd->done);
+	sqe->len = datasize - efd->done;
+	sqe->off = -1;
+	sqe->user_data = num;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->queued++;
+}
+
+/*
+ * Every fd has one read in flight, which is queued again when it
+ * completes, so the submission queue never holds more than num_fds.
+ */
+static void uring_arm(struct event_context *ctx, struct uring *ring)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->num_fds; i++)
+		uring_queue_read(ring, &ctx->efds[i], i);
+}
+
+static void uring_receive(struct event_context *ctx, struct uring *ring,
+			  int measure)
+{
+	unsigned int active = ctx->num_fds;
+
+	while (active) {
+		unsigned int head, tail;
+		int ret;
+
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 1,
+			      IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			barf("SERVER: io_uring_enter");
+		}
+		ring->queued -= ret;
+
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe =
+				&ring->cqes[head & *ring->cq_mask];
+			struct event_fd *efd = &ctx->efds[cqe->user_data];
+
+			if (cqe->res < 0) {
+				errno = -cqe->res;
+				barf("SERVER: io_uring read");
+			}
+			if (event_consume(efd, cqe->res, measure))
+				active--;
+			else
+				uring_queue_read(ring, efd, cqe->user_data);
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+}
+
+/* One receiver for several fds */
+static void *event_receiver(struct event_context *ctx)
+{
+	struct uring ring;
+	struct worker_usage usage;
+	unsigned int i, round;
+	int epfd = -1;
+
+	reset_worker_signals();
+	if (event_mode == EVENT_EPOLL)
+		epfd = epoll_setup(ctx);
+	else
+		uring_init(&ring, ctx->num_fds);
+
+	for (round = 0; round < warmup + runs; round++) {
+		for (i = 0; i < ctx->num_fds; i++)
+			ctx->efds[i].left = ctx->num_packets;
+		if (event_mode == EVENT_EPOLL)
+			epoll_arm(ctx, epfd);
+		else
+			uring_arm(ctx, &ring);
+
+		/* Wait for start... */
+		ready(ctx->ready_out, ctx->wakefds, round);
+		if (round == warmup)
+			usage_sample(&usage);
+
+		if (event_mode == EVENT_EPOLL)
+			epoll_receive(ctx, epfd, round >= warmup);
+		else
+			uring_receive(ctx, &ring, round >= warmup);
 	}
+	tell_ready(ctx->ready_out);
+
+	if (event_mode == EVENT_EPOLL)
+		close(epfd);
+	else
+		uring_exit(&ring);
+	usage_add(&usage);
 	return NULL;
 }
 
-childinfo_t create_worker(void *ctx, void *(*func)(void *))
+/*
+ * With -a, every group runs on the CPUs of one topology domain, the
+ * groups taking turns over the domains. With spread, the receivers and
+ * the senders of a group run on the CPUs of different sockets.
+ */
+static char *placement_names[] = {
+	[PLACE_NONE] = "none",
+	[PLACE_CORE] = "core",
+	[PLACE_LLC] = "llc",
+	[PLACE_NODE] = "node",
+	[PLACE_SPREAD] = "spread",
+};
+
+static cpu_set_t *domains;
+static unsigned int num_domains;
+
+#define CPU_SYSFS "/sys/devices/system/cpu"
+
+/* Find the file that lists the CPUs sharing the domain with cpu */
+static int domain_path(int cpu, char *path, size_t size)
+{
+	char dir[MAX_PATH];
+	struct dirent *ent;
+	DIR *d;
+	int i, level, best = -1;
+
+	switch (placement) {
+	case PLACE_CORE:
+		snprintf(path, size, CPU_SYSFS "/cpu%d/topology/core_cpus_list",
+			 cpu);
+		if (access(path, R_OK))
+			snprintf(path, size, CPU_SYSFS
+				 "/cpu%d/topology/thread_siblings_list", cpu);
+		return 0;
+
+	case PLACE_LLC:
+		/* The last level cache is the one with the highest level */
+		for (i = 0; ; i++) {
+			FILE *f;
+
+			snprintf(dir, sizeof(dir), CPU_SYSFS
+				 "/cpu%d/cache/index%d/level", cpu, i);
+			f = fopen(dir, "r");
+			if (!f)
+				break;
+			if (fscanf(f, "%d", &level) == 1 && level > best) {
+				best = level;
+				snprintf(path, size, CPU_SYSFS
+					 "/cpu%d/cache/index%d/shared_cpu_list",
+					 cpu, i);
+			}
+			fclose(f);
+		}
+		return best < 0 ? -1 : 0;
+
+	case PLACE_NODE:
+		/* cpuN/nodeM links to the node the CPU belongs to */
+		snprintf(dir, sizeof(dir), CPU_SYSFS "/cpu%d", cpu);
+		d = opendir(dir);
+		if (!d)
+			return -1;
+		while ((ent = readdir(d)) != NULL) {
+			if (strncmp(ent->d_name, "node", 4) ||
+			    !isdigit(ent->d_name[4]))
+				continue;
+			if (snprintf(path, size, "%s/%s/cpulist", dir,
+				     ent->d_name) < size)
+				break;
+		}
+		closedir(d);
+		return ent ? 0 : -1;
+
+	default:
+		snprintf(path, size, CPU_SYSFS
+			 "/cpu%d/topology/package_cpus_list", cpu);
+		if (access(path, R_OK))
+			snprintf(path, size, CPU_SYSFS
+				 "/cpu%d/topology/core_siblings_list", cpu);
+		return 0;
+	}
+}
+
+/* Read the domain of cpu, limited to the CPUs we may run on */
+static int read_domain(int cpu, cpu_set_t *allowed, cpu_set_t *set)
+{
+	int cpus[CPU_SETSIZE];
+	char path[MAX_PATH], list[4096];
+	FILE *f;
+	int i, num;
+
+	if (domain_path(cpu, path, sizeof(path)))
+		return -1;
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (!fgets(list, sizeof(list), f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	list[strcspn(list, "\n")] = '\0';
+
+	num = parse_cpulist(list, cpus, CPU_SETSIZE);
+	if (num < 0)
+		return -1;
+	CPU_ZERO(set);
+	for (i = 0; i < num; i++)
+		CPU_SET(cpus[i], set);
+	CPU_AND(set, set, allowed);
+	return 0;
+}
+
+/* Collect the distinct domains of the CPUs we may run on */
+static void setup_domains(void)
+{
+	cpu_set_t allowed, set;
+	int cpu;
+	unsigned int i;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		barf("sched_getaffinity");
+	domains = calloc(CPU_COUNT(&allowed), sizeof(cpu_set_t));
+	if (!domains)
+		barf("main:malloc() [domains]");
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+		/* Without the topology, e.g. no NUMA, all CPUs are one */
+		if (read_domain(cpu, &allowed, &set) || !CPU_ISSET(cpu, &set))
+			set = allowed;
+		for (i = 0; i < num_domains; i++)
+			if (CPU_EQUAL(&set, &domains[i]))
+				break;
+		if (i == num_domains)
+			domains[num_domains++] = set;
+	}
+}
+
+/* The CPUs of the receivers or the senders of a group, NULL for any */
+static cpu_set_t *group_cpus(unsigned int num, int senders)
+{
+	if (placement == PLACE_NONE)
+		return NULL;
+	if (placement == PLACE_SPREAD)
+		return &domains[(2 * num + senders) % num_domains];
+	return &domains[num % num_domains];
+}
+
+childinfo_t create_worker(void *ctx, void *(*func)(void *), cpu_set_t *cpus)
 {
 	pthread_attr_t attr;
 	int err;
 	childinfo_t child;
 	pid_t childpid;
+	void *stack;
 
+	/* A pid does not fill the union, clear the rest of error */
+	child.error = 0;
 	switch (process_mode) {
 	case PROCESS_MODE: /* process mode */
 		/* Fork the sender/receiver child. */
@@ -205,6 +1562,8 @@ childinfo_t create_worker(void *ctx, void *(*func)(void *))
 				child.error = -1;
 				return child;
 			case 0:
+				if (cpus && sched_setaffinity(0, sizeof(*cpus), cpus))
+					barf("sched_setaffinity");
 				(*func) (ctx);
 				exit(0);
 		}
@@ -219,12 +1578,23 @@ childinfo_t create_worker(void *ctx, void *(*func)(void *))
 		}
 
 #ifndef __ia64__
-		if (pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN) != 0) {
-			sneeze("pthread_attr_setstacksize()");
+		/*
+		 * The workers keep their messages in the arena, the smallest
+		 * stack will do.
+		 */
+		stack = arena_alloc_stack(PTHREAD_STACK_MIN);
+		if (!stack ||
+		    pthread_attr_setstack(&attr, stack, PTHREAD_STACK_MIN) != 0) {
+			sneeze("pthread_attr_setstack()");
 			child.error = -1;
 			return child;
 		}
 #endif
+		if (cpus && pthread_attr_setaffinity_np(&attr, sizeof(*cpus), cpus) != 0) {
+			sneeze("pthread_attr_setaffinity_np()");
+			child.error = -1;
+			return child;
+		}
 
 		if ((err=pthread_create(&child.threadid, &attr, func, ctx)) != 0) {
 			sneeze("pthread_create failed()");
@@ -285,9 +1655,14 @@ static unsigned int group(childinfo_t *child,
 			  unsigned int tab_offset,
 			  unsigned int num_fds,
 			  int ready_out,
-			  int wakefd)
+			  int *wakefds)
 {
 	unsigned int i;
+	unsigned int num_rcv = group_receivers();
+	unsigned int num = tab_offset / (num_rcv + num_fds);
+	/* The first receiver and sender of the group */
+	unsigned int first = num * num_fds;
+	int in_fds[num_fds];
 	struct sender_context* snd_ctx = malloc (sizeof(struct sender_context)
 			+num_fds*sizeof(int));
 
@@ -299,51 +1674,123 @@ static unsigned int group(childinfo_t *child,
 
 	for (i = 0; i < num_fds; i++) {
 		int fds[2];
-		struct receiver_context* ctx = malloc (sizeof(*ctx));
+		struct receiver_context* ctx;
 
-		if (!ctx) {
+		/* Create the pipe between client and server */
+		if (transport == TRANSPORT_RING)
+			fds[0] = fds[1] = -1;
+		else
+			data_fdpair(fds);
+		snd_ctx->out_fds[i] = fds[1];
+		in_fds[i] = fds[0];
+		if (event_mode != EVENT_NONE)
+			continue;
+
+		ctx = arena_alloc(sizeof(*ctx));
+		if (ctx)
+			ctx->data = arena_alloc(datasize);
+		if (!ctx || !ctx->data) {
 			sneeze("malloc() [receiver ctx]");
 			return (i > 0 ? i-1 : 0);
 		}
 
-
-		/* Create the pipe between client and server */
-		fdpair(fds);
-
-		ctx->num_packets = num_fds*loops;
+		ctx->num_packets = duration ? num_fds : num_fds*loops;
 		ctx->in_fds[0] = fds[0];
 		ctx->in_fds[1] = fds[1];
 		ctx->ready_out = ready_out;
-		ctx->wakefd = wakefd;
-
-		child[tab_offset+i] = create_worker(ctx, (void *)(void *)receiver);
+		ctx->wakefds = wakefds;
+		ctx->hist = histogram ? receiver_hist(first + i) : NULL;
+		ctx->count = count_tab ? &count_tab[first + i] : NULL;
+		ctx->window = window_tab ? &window_tab[first + i] : NULL;
+		ctx->ring = first + i;
+		ctx->next_sender = 0;
+
+		child[tab_offset+i] = create_worker(ctx, (void *)(void *)receiver,
+						    group_cpus(num, 0));
 		if( child[tab_offset+i].error < 0 ) {
 			return (i > 0 ? i-1 : 0);
 		}
-		snd_ctx->out_fds[i] = fds[1];
-		if (process_mode == PROCESS_MODE)
+		if (process_mode == PROCESS_MODE && fds[0] >= 0)
 			close(fds[0]);
 	}
 
+	/* With -e, deal out the fds to the receivers round robin */
+	for (i = 0; event_mode != EVENT_NONE && i < num_rcv; i++) {
+		unsigned int j, n = (num_fds - i + num_rcv - 1) / num_rcv;
+		struct event_context *ctx = arena_alloc(sizeof(*ctx) +
+						n * sizeof(struct event_fd));
+
+		if (!ctx) {
+			sneeze("malloc() [receiver ctx]");
+			return (i > 0 ? i-1 : 0);
+		}
+		ctx->num_fds = n;
+		ctx->num_packets = duration ? num_fds : num_fds * loops;
+		ctx->ready_out = ready_out;
+		ctx->wakefds = wakefds;
+		for (j = 0; j < n; j++) {
+			struct event_fd *efd = &ctx->efds[j];
+			unsigned int fd = i + j * num_rcv;
+
+			efd->fd = in_fds[fd];
+			efd->hist = histogram ? receiver_hist(first + fd) :
+				NULL;
+			efd->count = count_tab ? &count_tab[first + fd] : NULL;
+			efd->window = window_tab ? &window_tab[first + fd] :
+				NULL;
+			efd->data = arena_alloc(datasize);
+			if (!efd->data) {
+				sneeze("malloc() [receiver ctx]");
+				return (i > 0 ? i-1 : 0);
+			}
+		}
+
+		child[tab_offset+i] = create_worker(ctx,
+					(void *)(void *)event_receiver,
+					group_cpus(num, 0));
+		if( child[tab_offset+i].error < 0 ) {
+			return (i > 0 ? i-1 : 0);
+		}
+	}
+	if (event_mode != EVENT_NONE && process_mode == PROCESS_MODE)
+		for (i = 0; i < num_fds; i++)
+			close(in_fds[i]);
+
 	/* Now we have all the fds, fork the senders */
 	for (i = 0; i < num_fds; i++) {
-		snd_ctx->ready_out = ready_out;
-		snd_ctx->wakefd = wakefd;
-		snd_ctx->num_fds = num_fds;
-
-		child[tab_offset+num_fds+i] = create_worker(snd_ctx, (void *)(void *)sender);
-		if( child[tab_offset+num_fds+i].error < 0 ) {
-			return (num_fds+i)-1;
+		size_t size = sizeof(*snd_ctx) + num_fds * sizeof(int);
+		struct sender_context *ctx = arena_alloc(size);
+
+		if (ctx)
+			memcpy(ctx, snd_ctx, size);
+		if (ctx)
+			ctx->data = arena_alloc(datasize);
+		if (!ctx || !ctx->data) {
+			sneeze("malloc() [sender ctx]");
+			return (num_rcv+i)-1;
+		}
+		ctx->ready_out = ready_out;
+		ctx->wakefds = wakefds;
+		ctx->num_fds = num_fds;
+		ctx->zc_socks = zc_sock_tab ? &zc_sock_tab[first] : NULL;
+		ctx->first = first;
+		ctx->num = i;
+
+		child[tab_offset+num_rcv+i] = create_worker(ctx, (void *)(void *)sender,
+							      group_cpus(num, 1));
+		if( child[tab_offset+num_rcv+i].error < 0 ) {
+			return (num_rcv+i)-1;
 		}
 	}
 
 	/* Close the fds we have left */
-	if (process_mode == PROCESS_MODE)
+	if (process_mode == PROCESS_MODE && transport != TRANSPORT_RING)
 		for (i = 0; i < num_fds; i++)
 			close(snd_ctx->out_fds[i]);
+	free(snd_ctx);
 
 	/* Return number of children to reap */
-	return num_fds * 2;
+	return num_rcv + num_fds;
 }
 
 static void process_options (int argc, char *argv[])
@@ -355,6 +1802,7 @@ static void process_options (int argc, char *argv[])
 
 		static struct option longopts[] = {
 			{"pipe",      no_argument,	 NULL, 'p'},
+			{"transport", required_argument, NULL, 't'},
 			{"datasize",  required_argument, NULL, 's'},
 			{"loops",     required_argument, NULL, 'l'},
 			{"groups",    required_argument, NULL, 'g'},
@@ -362,18 +1810,38 @@ static void process_options (int argc, char *argv[])
 			{"threads",   no_argument,	 NULL, 'T'},
 			{"processes", no_argument,	 NULL, 'P'},
 			{"fifo",      no_argument,       NULL, 'F'},
+			{"histogram", required_argument, NULL, 'H'},
+			{"zerocopy",  no_argument,       NULL, 'Z'},
+			{"event",     required_argument, NULL, 'e'},
+			{"receivers", required_argument, NULL, 'r'},
+			{"affinity",  required_argument, NULL, 'a'},
+			{"duration",  required_argument, NULL, 'D'},
+			{"rate",      required_argument, NULL, 'R'},
+			{"interval",  required_argument, NULL, 'i'},
+			{"runs",      required_argument, NULL, 'N'},
+			{"warmup",    required_argument, NULL, 'W'},
 			{"help",      no_argument,	 NULL, 'h'},
 			{NULL, 0, NULL, 0}
 		};
 
-		int c = getopt_long(argc, argv, "ps:l:g:f:TPFh",
+		int c = getopt_long(argc, argv, "pt:s:l:g:f:TPFH:Ze:r:a:D:R:i:N:W:h",
 				    longopts, &optind);
 		if (c == -1) {
 			break;
 		}
 		switch (c) {
 		case 'p':
-			use_pipes = 1;
+			transport = TRANSPORT_PIPE;
+			break;
+
+		case 't':
+			for (transport = 0; transport < TRANSPORT_NUM; transport++)
+				if (!strcmp(optarg, transport_names[transport]))
+					break;
+			if (transport == TRANSPORT_NUM) {
+				fprintf(stderr, "%s: --transport|-t must be socket, pipe, ring, dgram, seqpacket, tcp or udp\n", argv[0]);
+				error = 1;
+			}
 			break;
 
 		case 's':
@@ -415,6 +1883,83 @@ static void process_options (int argc, char *argv[])
 			fifo = 1;
 			break;
 
+		case 'H':
+			if (!(argv[optind] && (histogram = atoi(optarg)) > 0)) {
+				fprintf(stderr, "%s: --histogram|-H requires an integer > 0\n", argv[0]);
+				error = 1;
+			}
+			if (histogram > RT_HIST_MAX)
+				histogram = RT_HIST_MAX;
+			break;
+
+		case 'Z':
+			zerocopy = 1;
+			break;
+
+		case 'e':
+			if (!strcmp(optarg, "epoll"))
+				event_mode = EVENT_EPOLL;
+			else if (!strcmp(optarg, "io_uring"))
+				event_mode = EVENT_URING;
+			else {
+				fprintf(stderr, "%s: --event|-e must be epoll or io_uring\n", argv[0]);
+				error = 1;
+			}
+			break;
+
+		case 'r':
+			if (!(argv[optind] && (num_receivers = atoi(optarg)) > 0)) {
+				fprintf(stderr, "%s: --receivers|-r requires an integer > 0\n", argv[0]);
+				error = 1;
+			}
+			break;
+
+		case 'a':
+			for (placement = 0; placement < PLACE_NUM; placement++)
+				if (!strcmp(optarg, placement_names[placement]))
+					break;
+			if (placement == PLACE_NUM) {
+				fprintf(stderr, "%s: --affinity|-a must be none, core, llc, node or spread\n", argv[0]);
+				error = 1;
+			}
+			break;
+
+		case 'D':
+			if (!(argv[optind] && (duration = parse_time_string(optarg)) > 0)) {
+				fprintf(stderr, "%s: --duration|-D requires a time > 0\n", argv[0]);
+				error = 1;
+			}
+			break;
+
+		case 'R':
+			if (!(argv[optind] && (rate = atoi(optarg)) > 0)) {
+				fprintf(stderr, "%s: --rate|-R requires an integer > 0\n", argv[0]);
+				error = 1;
+			}
+			break;
+
+		case 'i':
+			if (!(argv[optind] && (interval = atoi(optarg)) > 0)) {
+				fprintf(stderr, "%s: --interval|-i requires an integer > 0\n", argv[0]);
+				error = 1;
+			}
+			break;
+
+		case 'N':
+			if (!(argv[optind] && (runs = atoi(optarg)) > 0)) {
+				fprintf(stderr, "%s: --runs|-N requires an integer > 0\n", argv[0]);
+				error = 1;
+			}
+			break;
+
+		case 'W':
+			if (!argv[optind] || atoi(optarg) < 0) {
+				fprintf(stderr, "%s: --warmup|-W requires an integer >= 0\n", argv[0]);
+				error = 1;
+			} else
+				warmup = atoi(optarg);
+			break;
+
 		case 'h':
 			print_usage_exit();
 
@@ -423,6 +1968,48 @@ static void process_options (int argc, char *argv[])
 		}
 	}
 
+	if (histogram && datasize < sizeof(uint64_t)) {
+		fprintf(stderr, "%s: --histogram|-H requires a datasize of at least %zu bytes\n",
+			argv[0], sizeof(uint64_t));
+		error = 1;
+	}
+
+	/* The end markers of -D must arrive whole */
+	if (duration && (datasize < sizeof(uint64_t) || datasize > PIPE_BUF)) {
+		fprintf(stderr, "%s: --duration|-D requires a datasize of %zu to %d bytes\n",
+			argv[0], sizeof(uint64_t), PIPE_BUF);
+		error = 1;
+	}
+	if (rate)
+		pace_ns = (uint64_t) num_fds * 1000000000 / rate;
+
+	if (transport == TRANSPORT_RING && (zerocopy || event_mode != EVENT_NONE)) {
+		fprintf(stderr, "%s: --transport|-t ring does not go with --zerocopy|-Z or --event|-e\n", argv[0]);
+		error = 1;
+	}
+	/* MSG_ZEROCOPY is not supported on AF_UNIX sockets */
+	if (zerocopy && transport != TRANSPORT_PIPE && transport != TRANSPORT_TCP) {
+		fprintf(stderr, "%s: --zerocopy|-Z requires --pipe|-p or --transport|-t tcp\n", argv[0]);
+		error = 1;
+	}
+	if ((transport == TRANSPORT_DGRAM || transport == TRANSPORT_SEQPACKET ||
+	     transport == TRANSPORT_UDP) && datasize > DGRAM_MAX) {
+		fprintf(stderr, "%s: --transport|-t %s requires a datasize of at most %d bytes\n",
+			argv[0], transport_names[transport], DGRAM_MAX);
+		error = 1;
+	}
+
+	if (num_receivers && event_mode == EVENT_NONE) {
+		fprintf(stderr, "%s: --receivers|-r requires --event|-e\n", argv[0]);
+		error = 1;
+	}
+	if (event_mode != EVENT_NONE) {
+		if (!num_receivers)
+			num_receivers = 1;
+		if (num_receivers > num_fds)
+			num_receivers = num_fds;
+	}
+
 	if( error ) {
 		exit(1);
 	}
@@ -436,11 +2023,168 @@ void sigcatcher(int sig) {
 	longjmp(jmpbuf, 1);
 }
 
-int main(int argc, char *argv[])
+static uint64_t group_msgs(unsigned int num)
+{
+	uint64_t msgs = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_fds; i++)
+		msgs += count_tab[num * num_fds + i].msgs;
+	return msgs;
+}
+
+/* The messages of every group when the round started, for -i */
+static uint64_t *interval_last;
+
+static void interval_start(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_groups; i++)
+		interval_last[i] = group_msgs(i);
+}
+
+/*
+ * With -i, print the messages per second of all groups and of every
+ * group during the last interval, until all workers are done with the
+ * round. Their ready bytes are read here, so that the round ends when
+ * the last one arrives and not at the end of an interval. Return how
+ * many have been read.
+ */
+static unsigned int report_intervals(int ready_in)
+{
+	uint64_t *last = interval_last, msgs[num_groups];
+	uint64_t total, last_total = 0, next, now;
+	unsigned int i, n, got = 0;
+	char buf[256];
+
+	for (i = 0; i < num_groups; i++)
+		last_total += last[i];
+	next = gettime_ns();
+	for (n = 1; ; n++) {
+		next += (uint64_t) interval * 1000000000;
+		while (got < total_children && (now = gettime_ns()) < next) {
+			struct pollfd pollfd = { .fd = ready_in, .events = POLLIN };
+			int ret;
+
+			ret = poll(&pollfd, 1, (next - now + 999999) / 1000000);
+			if (ret < 0 && errno != EINTR)
+				barf("poll");
+			if (ret <= 0)
+				continue;
+			ret = read(ready_in, buf, total_children - got < sizeof(buf) ?
+				   total_children - got : sizeof(buf));
+			if (ret <= 0)
+				barf("Reading for readyfds");
+			got += ret;
+		}
+		if (got == total_children)
+			return got;
+
+		total = 0;
+		for (i = 0; i < num_groups; i++) {
+			msgs[i] = group_msgs(i);
+			total += msgs[i];
+		}
+		printf("T: %6u s %10.0f msgs/s, per group:", n * interval,
+		       (double) (total - last_total) / interval);
+		for (i = 0; i < num_groups; i++) {
+			printf(" %.0f", (double) (msgs[i] - last[i]) / interval);
+			last[i] = msgs[i];
+		}
+		printf("\n");
+		fflush(stdout);
+		last_total = total;
+	}
+}
+
+/* The times of the measured rounds, and the messages they passed */
+static double *run_times;
+static unsigned int num_runs;
+static uint64_t run_msgs, last_msgs;
+static unsigned int cur_round;
+static int round_running;		/* between the kick and its end */
+static uint64_t setup_ns;		/* to create all workers */
+
+static uint64_t all_msgs(void)
+{
+	uint64_t msgs = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_groups; i++)
+		msgs += group_msgs(i);
+	return msgs;
+}
+
+static void end_round(unsigned int round, struct timeval *diff)
+{
+	double secs = diff->tv_sec + diff->tv_usec / 1000000.0;
+	uint64_t msgs = (uint64_t) num_groups * num_fds * num_fds * loops;
+
+	if (count_tab) {
+		msgs = all_msgs() - last_msgs;
+		last_msgs += msgs;
+	}
+	if (warmup + runs > 1)
+		printf("%s %u: %.3f s\n", round < warmup ? "Warmup" : "Run",
+		       round < warmup ? round + 1 : round - warmup + 1, secs);
+	if (round < warmup)
+		return;
+	run_times[num_runs++] = secs;
+	run_msgs += msgs;
+}
+
+/* Two-sided 95% quantiles of Student's t distribution */
+static const double t_95[] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+static void print_run_stats(void)
 {
+	double sum = 0, var = 0, min, max, mean, stddev, ci;
 	unsigned int i;
-	struct timeval start, stop, diff;
-	int readyfds[2], wakefds[2];
+
+	min = max = run_times[0];
+	for (i = 0; i < num_runs; i++) {
+		sum += run_times[i];
+		if (run_times[i] < min)
+			min = run_times[i];
+		if (run_times[i] > max)
+			max = run_times[i];
+	}
+	mean = sum / num_runs;
+	for (i = 0; i < num_runs; i++)
+		var += (run_times[i] - mean) * (run_times[i] - mean);
+	stddev = num_runs > 1 ? sqrt(var / (num_runs - 1)) : 0;
+	ci = num_runs > 1 ? stddev / sqrt(num_runs) *
+		(num_runs - 1 <= 30 ? t_95[num_runs - 2] : 1.960) : 0;
+
+	printf("Time: mean %.3f, stddev %.3f, min %.3f, max %.3f, 95%% CI %.3f..%.3f (%u runs)\n",
+	       mean, stddev, min, max, mean - ci, mean + ci, num_runs);
+}
+
+/* What the workers spent per message, to tell scheduling from copying */
+static void print_usage(void)
+{
+	struct worker_usage *u = usage_total;
+	double msgs = run_msgs;
+
+	printf("CPU per message (us): %.3f user, %.3f sys\n",
+	       u->user_us / msgs, u->sys_us / msgs);
+	printf("Context switches per message: %.3f voluntary, %.3f involuntary\n",
+	       u->nvcsw / msgs, u->nivcsw / msgs);
+	if (!u->no_migrations)
+		printf("Migrations: %lu, %.3f per message\n",
+		       (unsigned long) u->migrations, u->migrations / msgs);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i, got = 0;
+	static struct timeval start, stop, diff;	/* survive the longjmp */
+	int readyfds[2], wakefds[2][2], wake_in[2];
 	char dummy;
 	struct sched_param sp;
 
@@ -448,16 +2192,121 @@ int main(int argc, char *argv[])
 
 	printf("Running in %s mode with %d groups using %d file descriptors each (== %d tasks)\n",
 	       (process_mode == THREAD_MODE ? "threaded" : "process"),
-	       num_groups, 2*num_fds, num_groups*(num_fds*2));
-	printf("Each sender will pass %d messages of %d bytes\n", loops, datasize);
+	       num_groups, 2*num_fds, num_groups*(group_receivers()+num_fds));
+	if (event_mode != EVENT_NONE)
+		printf("Each group has %d receivers waiting in %s\n",
+		       num_receivers,
+		       event_mode == EVENT_EPOLL ? "epoll" : "io_uring");
+	if (placement != PLACE_NONE) {
+		setup_domains();
+		if (placement == PLACE_SPREAD)
+			printf("Receivers and senders of a group are spread over %u sockets\n",
+			       num_domains);
+		else
+			printf("Each group is pinned to one of %u %s domains\n",
+			       num_domains, placement_names[placement]);
+	}
+	if (duration)
+		printf("Each sender will pass messages of %d bytes for %u seconds\n",
+		       datasize, duration);
+	else
+		printf("Each sender will pass %d messages of %d bytes\n", loops, datasize);
+	if (rate)
+		printf("Each group will send %u messages/s\n", rate);
 	fflush(NULL);
 
-	child_tab = calloc(num_fds * 2 * num_groups, sizeof(childinfo_t));
-	if (!child_tab)
+	child_tab = calloc((group_receivers() + num_fds) * num_groups,
+			   sizeof(childinfo_t));
+	run_times = calloc(runs, sizeof(*run_times));
+	if (!child_tab || !run_times)
 		barf("main:malloc()");
 
+	if (histogram) {
+		hist_tab_size = num_groups * num_fds * rt_hist_size(histogram);
+		hist_tab = mmap(NULL, hist_tab_size, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if (hist_tab == MAP_FAILED)
+			barf("main:mmap() [histograms]");
+	}
+
+	if (duration || interval) {
+		count_tab_size = num_groups * num_fds * sizeof(struct msg_count);
+		count_tab = mmap(NULL, count_tab_size, PROT_READ|PROT_WRITE,
+				 MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if (count_tab == MAP_FAILED)
+			barf("main:mmap() [counters]");
+	}
+	if (interval) {
+		interval_last = calloc(num_groups, sizeof(*interval_last));
+		if (!interval_last)
+			barf("main:malloc() [intervals]");
+	}
+
+	if (transport == TRANSPORT_RING) {
+		ring_size = (sizeof(struct shm_ring) + RING_SLOTS * datasize +
+			     63) & ~63;
+		ring_tab_size = num_groups * num_fds * (num_fds * ring_size +
+							sizeof(struct ring_bell));
+		ring_tab = mmap(NULL, ring_tab_size, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if (ring_tab == MAP_FAILED)
+			barf("main:mmap() [rings]");
+		bell_tab = (struct ring_bell *) (ring_tab +
+				num_groups * num_fds * num_fds * ring_size);
+	}
+
+	if (transport == TRANSPORT_UDP) {
+		window_tab_size = num_groups * num_fds * sizeof(struct udp_window);
+		window_tab = mmap(NULL, window_tab_size, PROT_READ|PROT_WRITE,
+				  MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if (window_tab == MAP_FAILED)
+			barf("main:mmap() [windows]");
+	}
+
+	if (transport == TRANSPORT_TCP) {
+		pthread_mutexattr_t attr;
+
+		zc_sock_tab_size = num_groups * num_fds * sizeof(struct zc_sock);
+		zc_sock_tab = mmap(NULL, zc_sock_tab_size,
+				   PROT_READ|PROT_WRITE,
+				   MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if (zc_sock_tab == MAP_FAILED)
+			barf("main:mmap() [TCP sockets]");
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		for (i = 0; i < num_groups * num_fds; i++)
+			pthread_mutex_init(&zc_sock_tab[i].lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+	}
+
+	if (transport == TRANSPORT_TCP ||
+	    (histogram && (transport == TRANSPORT_SOCKET ||
+			   transport == TRANSPORT_PIPE))) {
+		pthread_mutexattr_t attr;
+
+		send_lock_tab_size = num_groups * num_fds *
+			sizeof(pthread_mutex_t);
+		send_lock_tab = mmap(NULL, send_lock_tab_size,
+				     PROT_READ|PROT_WRITE,
+				     MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if (send_lock_tab == MAP_FAILED)
+			barf("main:mmap() [send locks]");
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		for (i = 0; i < num_groups * num_fds; i++)
+			pthread_mutex_init(&send_lock_tab[i], &attr);
+		pthread_mutexattr_destroy(&attr);
+	}
+
+	usage_total = arena_alloc(sizeof(*usage_total));
+	if (!usage_total)
+		barf("main:malloc() [usage]");
+
 	fdpair(readyfds);
-	fdpair(wakefds);
+	fdpair(wakefds[0]);
+	fdpair(wakefds[1]);
+	wake_in[0] = wakefds[0][0];
+	wake_in[1] = wakefds[1][0];
 
 	/* Catch some signals */
 	signal(SIGINT, sigcatcher);
@@ -465,16 +2314,19 @@ int main(int argc, char *argv[])
 	signal(SIGHUP, SIG_IGN);
 
 	if (setjmp(jmpbuf) == 0) {
+		setup_ns = gettime_ns();
 		total_children = 0;
 		for (i = 0; i < num_groups; i++) {
-			int c = group(child_tab, total_children, num_fds, readyfds[1], wakefds[0]);
-			if( c != (num_fds*2) ) {
-				fprintf(stderr, "%i children started.  Expected %i\n", c, num_fds*2);
+			int c = group(child_tab, total_children, num_fds, readyfds[1], wake_in);
+			if( c != group_receivers() + num_fds ) {
+				fprintf(stderr, "%i children started.  Expected %i\n", c, group_receivers() + num_fds);
 				reap_workers(child_tab, total_children + c, 1);
 				barf("Creating workers");
 			}
 			total_children += c;
 		}
+		if (tcp_listener >= 0)
+			close(tcp_listener);
 		if (fifo) {
 			/* make main a realtime task so that we can manage the workers */
 			sp.sched_priority = 1;
@@ -482,19 +2334,46 @@ int main(int argc, char *argv[])
 				barf("can't change to fifo in main");
 		}
 
-		/* Wait for everyone to be ready */
-		for (i = 0; i < total_children; i++)
-			if (read(readyfds[0], &dummy, 1) != 1) {
+		/* The workers are ready once more when the last round is over */
+		for (cur_round = 0; ; cur_round++) {
+			/* Wait for everyone to be ready, i.e. done with the last round */
+			for (i = got; i < total_children; i++)
+				if (read(readyfds[0], &dummy, 1) != 1) {
+					reap_workers(child_tab, total_children, 1);
+					barf("Reading for readyfds");
+				}
+			if (cur_round == 0) {
+				setup_ns = gettime_ns() - setup_ns;
+				printf("Setup: %.3f\n", setup_ns / 1000000000.0);
+			}
+			if (cur_round > 0) {
+				gettimeofday(&stop, NULL);
+				timersub(&stop, &start, &diff);
+				end_round(cur_round - 1, &diff);
+				round_running = 0;
+			}
+			if (cur_round == warmup + runs)
+				break;
+			if (cur_round > 0) {
+				/* Everyone is past the wake fd of the last round */
+				if (read(wakefds[(cur_round - 1) & 1][0], &dummy, 1) != 1) {
+					reap_workers(child_tab, total_children, 1);
+					barf("Reading for wakefds");
+				}
+			}
+
+			if (interval)
+				interval_start();
+			gettimeofday(&start, NULL);
+			round_running = 1;
+
+			/* Kick them off */
+			if (write(wakefds[cur_round & 1][1], &dummy, 1) != 1) {
 				reap_workers(child_tab, total_children, 1);
-				barf("Reading for readyfds");
+				barf("Writing to start senders");
 			}
-		
-		gettimeofday(&start, NULL);
-		
-		/* Kick them off */
-		if (write(wakefds[1], &dummy, 1) != 1) {
-			reap_workers(child_tab, total_children, 1);
-			barf("Writing to start senders");
+
+			got = interval ? report_intervals(readyfds[0]) : 0;
 		}
 	}
 	else {
@@ -503,14 +2382,66 @@ int main(int argc, char *argv[])
 		signal(SIGTERM, SIG_IGN);
 	}
 
+	/* A round that was interrupted ends now */
+	if (round_running) {
+		gettimeofday(&stop, NULL);
+		timersub(&stop, &start, &diff);
+		end_round(cur_round, &diff);
+	}
+
 	/* Reap them all */
 	reap_workers(child_tab, total_children, signal_caught);
 
-	gettimeofday(&stop, NULL);
-
 	/* Print time... */
-	timersub(&stop, &start, &diff);
-	printf("Time: %lu.%03lu\n", diff.tv_sec, diff.tv_usec/1000);
+	if (warmup + runs == 1 && num_runs)
+		printf("Time: %.3f\n", run_times[0]);
+	else if (num_runs)
+		print_run_stats();
+	if (num_runs) {
+		double secs = 0;
+
+		for (i = 0; i < num_runs; i++)
+			secs += run_times[i];
+		if (secs > 0)
+			printf("Throughput: %.0f messages/s, %.0f bytes/s\n",
+			       run_msgs / secs, run_msgs * datasize / secs);
+	}
+	/* Killed workers did not add theirs */
+	if (run_msgs && !signal_caught)
+		print_usage();
+
+	/* ... and the delivery latency of all receivers together */
+	if (histogram) {
+		struct rt_hist *total = calloc(1, rt_hist_size(histogram));
+
+		if (!total)
+			barf("main:malloc() [histogram]");
+		for (i = 0; i < num_groups * num_fds; i++)
+			rt_hist_merge(total, receiver_hist(i), histogram);
+		printf("Latency (us): p50 %lu, p99 %lu, p99.9 %lu, max %lu\n",
+		       rt_hist_percentile(total, histogram, 500),
+		       rt_hist_percentile(total, histogram, 990),
+		       rt_hist_percentile(total, histogram, 999),
+		       total->max);
+		if (total->overflow)
+			printf("Latency above %u us: %lu of %lu messages\n",
+			       histogram, total->overflow, total->count);
+		free(total);
+		munmap(hist_tab, hist_tab_size);
+	}
+	if (zc_sock_tab)
+		munmap(zc_sock_tab, zc_sock_tab_size);
+	if (send_lock_tab)
+		munmap(send_lock_tab, send_lock_tab_size);
+	if (count_tab)
+		munmap(count_tab, count_tab_size);
+	if (ring_tab)
+		munmap(ring_tab, ring_tab_size);
+	if (window_tab)
+		munmap(window_tab, window_tab_size);
+	arena_free();
+	free(interval_last);
+	free(run_times);
 	free(child_tab);
 	exit(0);
 }
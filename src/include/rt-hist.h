@@ -0,0 +1,33 @@
+#ifndef __RT_HIST_H
+#define __RT_HIST_H
+
+#include <stddef.h>
+
+#define RT_HIST_MAX	1000000
+
+/*
+ * Latency histogram with buckets of one microsecond. The buckets follow
+ * the struct, so that the histogram of a forked receiver can be placed in
+ * the shared memory of the IPC tests, see rt-shm.h.
+ */
+struct rt_hist {
+	unsigned long count;
+	unsigned long min;
+	unsigned long max;
+	unsigned long overflow;
+	double sum;
+	unsigned long bucket[];
+};
+
+static inline size_t rt_hist_size(int buckets)
+{
+	return sizeof(struct rt_hist) + buckets * sizeof(unsigned long);
+}
+
+void rt_hist_add(struct rt_hist *hist, int buckets, unsigned long value);
+void rt_hist_merge(struct rt_hist *dst, struct rt_hist *src, int buckets);
+unsigned long rt_hist_percentile(struct rt_hist *hist, int buckets,
+				 int per_mille);
+void rt_hist_print(struct rt_hist *hist[], int nhist, int buckets);
+
+#endif	/* __RT_HIST_H */
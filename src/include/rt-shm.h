@@ -0,0 +1,81 @@
+#ifndef __RT_SHM_H
+#define __RT_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Shared memory layout of the IPC tests in fork mode (-f, -F in pmqtest).
+ * The region starts with a header that describes the layout, followed by
+ * five arrays of num_pairs slots each:
+ *
+ *   receiver params | sender params | timestamps | histograms | sync objects
+ *
+ * Every slot starts and ends on a cache line boundary, so that the
+ * sender, the receiver and the timestamp they hand over never share a
+ * cache line. The forked children check magic, version and slot sizes
+ * before they use the region.
+ */
+#define RT_SHM_MAGIC		0x72747368	/* "rtsh" */
+#define RT_SHM_VERSION		2
+#define RT_SHM_CACHELINE	64
+
+enum {
+	RT_SHM_RECEIVER,
+	RT_SHM_SENDER,
+	RT_SHM_STAMP,
+	RT_SHM_HIST,
+	RT_SHM_SYNC,
+	RT_SHM_NUM_AREAS
+};
+
+struct rt_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_pairs;
+	uint32_t total_size;
+	uint32_t size[RT_SHM_NUM_AREAS];
+	uint32_t offset[RT_SHM_NUM_AREAS];
+} __attribute__((aligned(RT_SHM_CACHELINE)));
+
+/* Written by the sender right before it wakes up the receiver */
+struct rt_shm_stamp {
+	volatile uint64_t ns;
+} __attribute__((aligned(RT_SHM_CACHELINE)));
+
+struct rt_shm {
+	void *base;
+	size_t size;
+	char *name;
+};
+
+static inline uint64_t rt_shm_gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * How long the main loop of a test sleeps between looking at its pairs:
+ * 50 ms to keep the live output current, 500 ms with -q, which only
+ * prints the summary.
+ */
+static inline void rt_shm_maindelay(struct timespec *delay, int quiet)
+{
+	delay->tv_sec = 0;
+	delay->tv_nsec = quiet ? 500000000 : 50000000;
+}
+
+int rt_shm_create(struct rt_shm *shm, char *name, int num_pairs,
+		  size_t params_size, size_t hist_size, size_t sync_size);
+int rt_shm_attach(struct rt_shm *shm, char *name, size_t params_size,
+		  size_t sync_size);
+void rt_shm_detach(struct rt_shm *shm);
+void rt_shm_destroy(struct rt_shm *shm);
+int rt_shm_num_pairs(struct rt_shm *shm);
+void *rt_shm_slot(struct rt_shm *shm, int area, int num);
+
+#endif	/* __RT_SHM_H */
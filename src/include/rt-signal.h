@@ -0,0 +1,37 @@
+#ifndef __RT_SIGNAL_H
+#define __RT_SIGNAL_H
+
+#include <signal.h>
+#include <stdint.h>
+
+/*
+ * Ways to receive a blocked signal in the signal tests. All but sigwait()
+ * see the payload of a signal that was sent with sigqueue(). sigtimedwait()
+ * and the epoll_wait() in front of the signalfd read give up after
+ * RT_SIGNAL_TIMEOUT_MS, so that the caller can check for shutdown.
+ */
+#define RT_SIGNAL_TIMEOUT_MS	1000
+
+enum {
+	RT_SIGNAL_SIGWAIT,
+	RT_SIGNAL_SIGWAITINFO,
+	RT_SIGNAL_SIGTIMEDWAIT,
+	RT_SIGNAL_SIGNALFD,
+	RT_SIGNAL_NUM_MODES
+};
+
+struct rt_signal_waiter {
+	int mode;
+	sigset_t set;
+	int fd;
+	int epfd;
+};
+
+extern char *rt_signal_mode_names[RT_SIGNAL_NUM_MODES];
+
+int rt_signal_parse_mode(char *name);
+int rt_signal_init(struct rt_signal_waiter *w, int mode, int sig);
+int rt_signal_wait(struct rt_signal_waiter *w, uintptr_t *payload);
+void rt_signal_cleanup(struct rt_signal_waiter *w);
+
+#endif	/* __RT_SIGNAL_H */
@@ -6,6 +6,8 @@
 #define MAX_PATH 256
 
 int check_privs(void);
+int parse_cpulist(char *str, int *cpus, int maxcpus);
+int parse_time_string(char *val);
 char *get_debugfileprefix(void);
 int mount_debugfs(char *);
 int get_tracers(char ***);
@@ -0,0 +1,1666 @@
+/*
+ * ipctest.c
+ *
+ * Based on pmqtest.c, ptsematest.c, svsematest.c and sigwaittest.c
+ * Copyright (C) 2009 Carsten Emde <C.Emde@osadl.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/sem.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#include <linux/unistd.h>
+#include <utmpx.h>
+#include <mqueue.h>
+#include "rt-utils.h"
+#include "rt-get_cpu.h"
+#include "error.h"
+
+#include <pthread.h>
+
+#define gettid() syscall(__NR_gettid)
+
+#define USEC_PER_SEC 1000000
+#define NSEC_PER_SEC 1000000000
+
+#define MQ_NAME "/ipctest%d.%d"
+#define MQ_MSG_SIZE 8
+
+#define MAX_TRANSPORTS 16
+
+#define MATRIX_LOOPS 10000
+#define TRANSPORT_LOOPS 1000
+
+#define FANOUT_TRANSPORTS "futex,condvar,eventfd"
+
+enum {
+	AFFINITY_UNSPECIFIED,
+	AFFINITY_SPECIFIED,
+	AFFINITY_USEALL
+};
+
+enum {
+	CHANNEL_TEST,	/* sender -> receiver, this is what we measure */
+	CHANNEL_SYNC,	/* receiver -> sender, receiver is ready again */
+};
+
+/*
+ * One direction of a sender/receiver pair. Every transport only uses
+ * the members it needs.
+ */
+struct channel {
+	int fd[2];
+	mqd_t mq;
+	int semid;
+	int signo;
+	int flag;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+struct latency {
+	unsigned int min, max;
+	long cur;
+	double sum;
+};
+
+struct params;
+
+/*
+ * A group of one sender and num_receivers receivers for the fan-out
+ * mode: the sender wakes all receivers with a single broadcast, the
+ * receivers report back and the last one to do so wakes the sender.
+ */
+struct group {
+	int num_receivers;
+	int generation;
+	int remaining;
+	int done;
+	int *fds;
+	int donefd;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond, donecond;
+	struct timespec sent, completed;
+	long *woken;
+	long *sorted;
+	struct params *receivers;
+	struct latency first, median, last, fanin;
+};
+
+/*
+ * A transport provides a binary event: post() wakes up the thread that
+ * is blocked in wait(), wait() returns after exactly one post().
+ * Both return 0 on success, or -1 with errno set.
+ *
+ * Transports that support the fan-out mode also provide broadcast(),
+ * which wakes all receivers of a group blocked in wait_broadcast(), and
+ * complete(), which every receiver calls once per broadcast. The sender
+ * returns from wait_complete() when all receivers have completed.
+ */
+struct transport {
+	char *name;
+	char *description;
+	int (*init)(struct channel *ch, int num, int dir);
+	void (*cleanup)(struct channel *ch, int num, int dir);
+	int (*post)(struct params *par, struct channel *ch);
+	int (*wait)(struct params *par, struct channel *ch);
+	int (*group_init)(struct group *grp);
+	void (*group_cleanup)(struct group *grp);
+	int (*broadcast)(struct params *par, struct group *grp);
+	int (*wait_broadcast)(struct params *par, struct group *grp);
+	int (*complete)(struct params *par, struct group *grp, int last);
+	int (*wait_complete)(struct params *par, struct group *grp);
+};
+
+struct params {
+	int num;
+	int cpu;
+	int priority;
+	int sender;
+	int samples;
+	int max_cycles;
+	int tracelimit;
+	int tid;
+	int shutdown;
+	int stopped;
+	struct timespec delay;
+	unsigned int mindiff, maxdiff;
+	double sumdiff;
+	struct timespec unblocked, received;
+	long diff;
+	long *values;
+	pthread_t threadid;
+	struct transport *transport;
+	struct channel *test, *sync;
+	struct group *group;
+	int generation;
+	struct params *neighbor;
+	char error[MAX_PATH * 2];
+};
+
+static inline long calcdiff(struct timespec t1, struct timespec t2)
+{
+	long diff;
+	diff = USEC_PER_SEC * ((int) t1.tv_sec - (int) t2.tv_sec);
+	diff += ((int) t1.tv_nsec - (int) t2.tv_nsec) / 1000;
+	return diff;
+}
+
+static inline void update_latency(struct latency *lat, long diff)
+{
+	lat->cur = diff;
+	if (diff < lat->min)
+		lat->min = diff;
+	if (diff > lat->max)
+		lat->max = diff;
+	lat->sum += (double) diff;
+}
+
+static int cmplong(const void *a, const void *b)
+{
+	long x = *(const long *) a, y = *(const long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of num sorted values */
+static long percentile(long *values, int num, double pct)
+{
+	int rank = (int) (pct / 100.0 * num + 0.999999);
+
+	if (rank < 1)
+		rank = 1;
+	if (rank > num)
+		rank = num;
+	return values[rank - 1];
+}
+
+/* POSIX message queue */
+static int pmq_init(struct channel *ch, int num, int dir)
+{
+	char mqname[32];
+	struct mq_attr mqstat;
+
+	memset(&mqstat, 0, sizeof(mqstat));
+	mqstat.mq_maxmsg = 1;
+	mqstat.mq_msgsize = MQ_MSG_SIZE;
+
+	sprintf(mqname, MQ_NAME, num, dir);
+	ch->mq = mq_open(mqname, O_CREAT|O_RDWR, 0600, &mqstat);
+	if (ch->mq == (mqd_t) -1)
+		return -1;
+	/* The descriptor stays valid, don't leave the queue behind */
+	mq_unlink(mqname);
+	return 0;
+}
+
+static void pmq_cleanup(struct channel *ch, int num, int dir)
+{
+	mq_close(ch->mq);
+}
+
+static int pmq_post(struct params *par, struct channel *ch)
+{
+	char msg[MQ_MSG_SIZE] = "Testing";
+
+	return mq_send(ch->mq, msg, sizeof(msg), 1);
+}
+
+static int pmq_wait(struct params *par, struct channel *ch)
+{
+	char msg[MQ_MSG_SIZE];
+
+	return mq_receive(ch->mq, msg, sizeof(msg), NULL) ==
+	    sizeof(msg) ? 0 : -1;
+}
+
+/*
+ * POSIX mutex, used like in ptsematest: the mutex is locked while the
+ * event is not posted, post() unlocks it and wait() locks it again.
+ */
+static int mutex_init(struct channel *ch, int num, int dir)
+{
+	if ((errno = pthread_mutex_init(&ch->mutex, NULL)))
+		return -1;
+	pthread_mutex_lock(&ch->mutex);
+	return 0;
+}
+
+static void mutex_cleanup(struct channel *ch, int num, int dir)
+{
+}
+
+static int mutex_post(struct params *par, struct channel *ch)
+{
+	return (errno = pthread_mutex_unlock(&ch->mutex)) ? -1 : 0;
+}
+
+static int mutex_wait(struct params *par, struct channel *ch)
+{
+	return (errno = pthread_mutex_lock(&ch->mutex)) ? -1 : 0;
+}
+
+/* SysV semaphore */
+static int svsem_init(struct channel *ch, int num, int dir)
+{
+	ch->semid = semget(IPC_PRIVATE, 1, 0600 | IPC_CREAT);
+	return ch->semid == -1 ? -1 : 0;
+}
+
+static void svsem_cleanup(struct channel *ch, int num, int dir)
+{
+	semctl(ch->semid, 0, IPC_RMID);
+}
+
+static int svsem_post(struct params *par, struct channel *ch)
+{
+	struct sembuf sb = { 0, 1, 0 };
+
+	return semop(ch->semid, &sb, 1);
+}
+
+static int svsem_wait(struct params *par, struct channel *ch)
+{
+	struct sembuf sb = { 0, -1, 0 };
+
+	return semop(ch->semid, &sb, 1);
+}
+
+/*
+ * Signals, received with sigwait(). SIGUSR1 and SIGUSR2 are blocked in
+ * all threads by main().
+ */
+static int signal_init(struct channel *ch, int num, int dir)
+{
+	ch->signo = dir == CHANNEL_TEST ? SIGUSR2 : SIGUSR1;
+	return 0;
+}
+
+static void signal_cleanup(struct channel *ch, int num, int dir)
+{
+}
+
+static int signal_post(struct params *par, struct channel *ch)
+{
+	return (errno = pthread_kill(par->neighbor->threadid, ch->signo)) ?
+	    -1 : 0;
+}
+
+static int signal_wait(struct params *par, struct channel *ch)
+{
+	sigset_t sigset;
+	int sig;
+
+	sigemptyset(&sigset);
+	sigaddset(&sigset, ch->signo);
+	return (errno = sigwait(&sigset, &sig)) ? -1 : 0;
+}
+
+/* eventfd */
+static int eventfd_init(struct channel *ch, int num, int dir)
+{
+	ch->fd[0] = eventfd(0, 0);
+	return ch->fd[0] == -1 ? -1 : 0;
+}
+
+static void eventfd_cleanup(struct channel *ch, int num, int dir)
+{
+	close(ch->fd[0]);
+}
+
+static int eventfd_post(struct params *par, struct channel *ch)
+{
+	uint64_t val = 1;
+
+	return write(ch->fd[0], &val, sizeof(val)) == sizeof(val) ? 0 : -1;
+}
+
+static int eventfd_wait(struct params *par, struct channel *ch)
+{
+	uint64_t val;
+
+	return read(ch->fd[0], &val, sizeof(val)) == sizeof(val) ? 0 : -1;
+}
+
+/*
+ * eventfd has no broadcast, every receiver gets its own eventfd and the
+ * sender writes to all of them in turn. The completions are added up
+ * on a single eventfd.
+ */
+static int eventfd_group_init(struct group *grp)
+{
+	int i;
+
+	grp->fds = calloc(grp->num_receivers, sizeof(int));
+	if (grp->fds == NULL)
+		return -1;
+	for (i = 0; i < grp->num_receivers; i++) {
+		grp->fds[i] = eventfd(0, 0);
+		if (grp->fds[i] == -1)
+			return -1;
+	}
+	grp->donefd = eventfd(0, 0);
+	return grp->donefd == -1 ? -1 : 0;
+}
+
+static void eventfd_group_cleanup(struct group *grp)
+{
+	int i;
+
+	for (i = 0; i < grp->num_receivers; i++)
+		close(grp->fds[i]);
+	close(grp->donefd);
+	free(grp->fds);
+}
+
+static int eventfd_broadcast(struct params *par, struct group *grp)
+{
+	uint64_t val = 1;
+	int i;
+
+	for (i = 0; i < grp->num_receivers; i++)
+		if (write(grp->fds[i], &val, sizeof(val)) != sizeof(val))
+			return -1;
+	return 0;
+}
+
+static int eventfd_wait_broadcast(struct params *par, struct group *grp)
+{
+	uint64_t val;
+
+	return read(grp->fds[par->num], &val, sizeof(val)) == sizeof(val) ?
+	    0 : -1;
+}
+
+static int eventfd_complete(struct params *par, struct group *grp, int last)
+{
+	uint64_t val = 1;
+
+	return write(grp->donefd, &val, sizeof(val)) == sizeof(val) ? 0 : -1;
+}
+
+static int eventfd_wait_complete(struct params *par, struct group *grp)
+{
+	uint64_t val, total = 0;
+
+	while (total < grp->num_receivers) {
+		if (read(grp->donefd, &val, sizeof(val)) != sizeof(val))
+			return -1;
+		total += val;
+	}
+	return 0;
+}
+
+/* pipe and UNIX datagram socket, both carry a single byte */
+static int pipe_init(struct channel *ch, int num, int dir)
+{
+	return pipe(ch->fd);
+}
+
+static int unix_init(struct channel *ch, int num, int dir)
+{
+	return socketpair(AF_UNIX, SOCK_DGRAM, 0, ch->fd);
+}
+
+static void fd_cleanup(struct channel *ch, int num, int dir)
+{
+	close(ch->fd[0]);
+	close(ch->fd[1]);
+}
+
+static int fd_post(struct params *par, struct channel *ch)
+{
+	char dummy = '*';
+
+	return write(ch->fd[1], &dummy, 1) == 1 ? 0 : -1;
+}
+
+static int fd_wait(struct params *par, struct channel *ch)
+{
+	char dummy;
+
+	return read(ch->fd[0], &dummy, 1) == 1 ? 0 : -1;
+}
+
+/* Condition variable protecting a flag */
+static int condvar_init(struct channel *ch, int num, int dir)
+{
+	if ((errno = pthread_mutex_init(&ch->mutex, NULL)))
+		return -1;
+	if ((errno = pthread_cond_init(&ch->cond, NULL)))
+		return -1;
+	ch->flag = 0;
+	return 0;
+}
+
+static void condvar_cleanup(struct channel *ch, int num, int dir)
+{
+}
+
+static int condvar_post(struct params *par, struct channel *ch)
+{
+	pthread_mutex_lock(&ch->mutex);
+	ch->flag = 1;
+	pthread_cond_signal(&ch->cond);
+	pthread_mutex_unlock(&ch->mutex);
+	return 0;
+}
+
+static int condvar_wait(struct params *par, struct channel *ch)
+{
+	pthread_mutex_lock(&ch->mutex);
+	while (!ch->flag)
+		pthread_cond_wait(&ch->cond, &ch->mutex);
+	ch->flag = 0;
+	pthread_mutex_unlock(&ch->mutex);
+	return 0;
+}
+
+/* Condition variable broadcast on a generation counter */
+static int condvar_group_init(struct group *grp)
+{
+	if ((errno = pthread_mutex_init(&grp->mutex, NULL)))
+		return -1;
+	if ((errno = pthread_cond_init(&grp->cond, NULL)))
+		return -1;
+	if ((errno = pthread_cond_init(&grp->donecond, NULL)))
+		return -1;
+	return 0;
+}
+
+static void condvar_group_cleanup(struct group *grp)
+{
+}
+
+static int condvar_broadcast(struct params *par, struct group *grp)
+{
+	pthread_mutex_lock(&grp->mutex);
+	grp->generation++;
+	pthread_cond_broadcast(&grp->cond);
+	pthread_mutex_unlock(&grp->mutex);
+	return 0;
+}
+
+static int condvar_wait_broadcast(struct params *par, struct group *grp)
+{
+	pthread_mutex_lock(&grp->mutex);
+	while (grp->generation == par->generation)
+		pthread_cond_wait(&grp->cond, &grp->mutex);
+	par->generation = grp->generation;
+	pthread_mutex_unlock(&grp->mutex);
+	return 0;
+}
+
+static int condvar_complete(struct params *par, struct group *grp, int last)
+{
+	pthread_mutex_lock(&grp->mutex);
+	if (last) {
+		grp->done = 1;
+		pthread_cond_signal(&grp->donecond);
+	}
+	pthread_mutex_unlock(&grp->mutex);
+	return 0;
+}
+
+static int condvar_wait_complete(struct params *par, struct group *grp)
+{
+	pthread_mutex_lock(&grp->mutex);
+	while (!grp->done)
+		pthread_cond_wait(&grp->donecond, &grp->mutex);
+	grp->done = 0;
+	pthread_mutex_unlock(&grp->mutex);
+	return 0;
+}
+
+/* Bare futex on a flag word */
+static int futex_init(struct channel *ch, int num, int dir)
+{
+	ch->flag = 0;
+	return 0;
+}
+
+static void futex_cleanup(struct channel *ch, int num, int dir)
+{
+}
+
+static int futex_post(struct params *par, struct channel *ch)
+{
+	__sync_bool_compare_and_swap(&ch->flag, 0, 1);
+	if (syscall(__NR_futex, &ch->flag, FUTEX_WAKE_PRIVATE, 1,
+	    NULL, NULL, 0) == -1)
+		return -1;
+	return 0;
+}
+
+static int futex_wait(struct params *par, struct channel *ch)
+{
+	while (!__sync_bool_compare_and_swap(&ch->flag, 1, 0)) {
+		if (syscall(__NR_futex, &ch->flag, FUTEX_WAIT_PRIVATE, 0,
+		    NULL, NULL, 0) == -1 && errno != EAGAIN && errno != EINTR)
+			return -1;
+		if (par->shutdown)
+			return -1;
+	}
+	return 0;
+}
+
+/* FUTEX_WAKE of all waiters on a generation counter */
+static int futex_group_init(struct group *grp)
+{
+	return 0;
+}
+
+static void futex_group_cleanup(struct group *grp)
+{
+}
+
+static int futex_broadcast(struct params *par, struct group *grp)
+{
+	__sync_add_and_fetch(&grp->generation, 1);
+	if (syscall(__NR_futex, &grp->generation, FUTEX_WAKE_PRIVATE,
+	    INT_MAX, NULL, NULL, 0) == -1)
+		return -1;
+	return 0;
+}
+
+static int futex_wait_broadcast(struct params *par, struct group *grp)
+{
+	int generation;
+
+	while ((generation = grp->generation) == par->generation) {
+		if (syscall(__NR_futex, &grp->generation, FUTEX_WAIT_PRIVATE,
+		    generation, NULL, NULL, 0) == -1 && errno != EAGAIN &&
+		    errno != EINTR)
+			return -1;
+		if (par->shutdown)
+			return -1;
+	}
+	par->generation = generation;
+	return 0;
+}
+
+static int futex_complete(struct params *par, struct group *grp, int last)
+{
+	if (!last)
+		return 0;
+	__sync_bool_compare_and_swap(&grp->done, 0, 1);
+	if (syscall(__NR_futex, &grp->done, FUTEX_WAKE_PRIVATE, 1,
+	    NULL, NULL, 0) == -1)
+		return -1;
+	return 0;
+}
+
+static int futex_wait_complete(struct params *par, struct group *grp)
+{
+	while (!__sync_bool_compare_and_swap(&grp->done, 1, 0)) {
+		if (syscall(__NR_futex, &grp->done, FUTEX_WAIT_PRIVATE, 0,
+		    NULL, NULL, 0) == -1 && errno != EAGAIN && errno != EINTR)
+			return -1;
+		if (par->shutdown)
+			return -1;
+	}
+	return 0;
+}
+
+static struct transport transports[] = {
+	{ "pmq", "POSIX message queue, mq_send()/mq_receive()",
+	  pmq_init, pmq_cleanup, pmq_post, pmq_wait },
+	{ "mutex", "POSIX mutex, pthread_mutex_unlock()/pthread_mutex_lock()",
+	  mutex_init, mutex_cleanup, mutex_post, mutex_wait },
+	{ "svsem", "SYSV semaphore, semop()",
+	  svsem_init, svsem_cleanup, svsem_post, svsem_wait },
+	{ "signal", "signal, pthread_kill()/sigwait()",
+	  signal_init, signal_cleanup, signal_post, signal_wait },
+	{ "eventfd", "eventfd, write()/read()",
+	  eventfd_init, eventfd_cleanup, eventfd_post, eventfd_wait,
+	  eventfd_group_init, eventfd_group_cleanup, eventfd_broadcast,
+	  eventfd_wait_broadcast, eventfd_complete, eventfd_wait_complete },
+	{ "pipe", "pipe, write()/read()",
+	  pipe_init, fd_cleanup, fd_post, fd_wait },
+	{ "unix", "UNIX datagram socket, write()/read()",
+	  unix_init, fd_cleanup, fd_post, fd_wait },
+	{ "condvar", "condition variable, pthread_cond_signal()/wait()",
+	  condvar_init, condvar_cleanup, condvar_post, condvar_wait,
+	  condvar_group_init, condvar_group_cleanup, condvar_broadcast,
+	  condvar_wait_broadcast, condvar_complete, condvar_wait_complete },
+	{ "futex", "futex, FUTEX_WAKE/FUTEX_WAIT",
+	  futex_init, futex_cleanup, futex_post, futex_wait,
+	  futex_group_init, futex_group_cleanup, futex_broadcast,
+	  futex_wait_broadcast, futex_complete, futex_wait_complete },
+	{ NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+static struct transport *find_transport(char *name)
+{
+	struct transport *tp;
+
+	for (tp = transports; tp->name != NULL; tp++)
+		if (!strcmp(tp->name, name))
+			return tp;
+	return NULL;
+}
+
+/* Common thread setup, returns whether the cpu must be tracked */
+static int setup_thread(struct params *par)
+{
+	int mustgetcpu = 0;
+	cpu_set_t mask;
+	int policy = SCHED_FIFO;
+	struct sched_param schedp;
+
+	memset(&schedp, 0, sizeof(schedp));
+	schedp.sched_priority = par->priority;
+	sched_setscheduler(0, policy, &schedp);
+
+	if (par->cpu != -1) {
+		CPU_ZERO(&mask);
+		CPU_SET(par->cpu, &mask);
+		if(sched_setaffinity(0, sizeof(mask), &mask) == -1)
+			snprintf(par->error, sizeof(par->error),
+			    "WARNING: Could not set CPU affinity "
+			    "to CPU #%d\n", par->cpu);
+	} else
+		mustgetcpu = 1;
+
+	par->tid = gettid();
+
+	return mustgetcpu;
+}
+
+static void breaktrace(struct params *par)
+{
+	char tracing_enabled_file[MAX_PATH];
+
+	strcpy(tracing_enabled_file, get_debugfileprefix());
+	strcat(tracing_enabled_file, "tracing_enabled");
+	int tracing_enabled =
+	    open(tracing_enabled_file, O_WRONLY);
+	if (tracing_enabled >= 0) {
+		write(tracing_enabled, "0", 1);
+		close(tracing_enabled);
+	} else
+		snprintf(par->error, sizeof(par->error),
+		    "Could not access %s\n",
+		    tracing_enabled_file);
+}
+
+void *ipcthread(void *param)
+{
+	struct params *par = param;
+	struct transport *tp = par->transport;
+	int mustgetcpu = setup_thread(par);
+
+	while (!par->shutdown) {
+		if (par->sender) {
+			/* Post the event: Start of latency measurement ... */
+			clock_gettime(CLOCK_MONOTONIC, &par->unblocked);
+			if (tp->post(par, par->test)) {
+				snprintf(par->error, sizeof(par->error),
+				    "%s: could not post test event: %s\n",
+				    tp->name, strerror(errno));
+				par->shutdown = 1;
+				break;
+			}
+			par->samples++;
+			if(par->max_cycles && par->samples >= par->max_cycles)
+				par->shutdown = 1;
+			if (mustgetcpu)
+				par->cpu = get_cpu();
+
+			/* Wait until receiver ready */
+			if (tp->wait(par, par->sync) && !par->shutdown) {
+				snprintf(par->error, sizeof(par->error),
+				    "%s: could not wait for sync event: %s\n",
+				    tp->name, strerror(errno));
+				par->shutdown = 1;
+			}
+		} else {
+			/* Receiver */
+			if (tp->wait(par, par->test)) {
+				if (!par->shutdown)
+					snprintf(par->error,
+					    sizeof(par->error),
+					    "%s: could not wait for test "
+					    "event: %s\n", tp->name,
+					    strerror(errno));
+				par->shutdown = 1;
+				break;
+			}
+
+			/* ... Got the event: End of latency measurement */
+			clock_gettime(CLOCK_MONOTONIC, &par->received);
+			par->samples++;
+			par->diff = calcdiff(par->received,
+			    par->neighbor->unblocked);
+
+			if (par->diff < par->mindiff)
+				par->mindiff = par->diff;
+			if (par->diff > par->maxdiff)
+				par->maxdiff = par->diff;
+			par->sumdiff += (double) par->diff;
+			if (par->values)
+				par->values[par->samples - 1] = par->diff;
+			if (par->tracelimit && par->maxdiff > par->tracelimit) {
+				breaktrace(par);
+				par->shutdown = 1;
+				par->neighbor->shutdown = 1;
+			}
+
+			if (par->max_cycles && par->samples >= par->max_cycles)
+				par->shutdown = 1;
+			if (mustgetcpu)
+				par->cpu = get_cpu();
+			nanosleep(&par->delay, NULL);
+
+			/* Tell sender that we are ready for the next measurement */
+			if (tp->post(par, par->sync)) {
+				snprintf(par->error, sizeof(par->error),
+				    "%s: could not post sync event: %s\n",
+				    tp->name, strerror(errno));
+				par->shutdown = 1;
+			}
+		}
+	}
+	par->stopped = 1;
+	return NULL;
+}
+
+/*
+ * Fan-out mode: the sender wakes all receivers of its group at once and
+ * waits for all of them to complete. Every receiver stores its wakeup
+ * latency, the sender turns them into first, median and last woken
+ * latency. The fan-in latency is the time between the completion of
+ * the last receiver and the sender being woken up.
+ */
+void *fanoutthread(void *param)
+{
+	struct params *par = param;
+	struct transport *tp = par->transport;
+	struct group *grp = par->group;
+	int mustgetcpu = setup_thread(par);
+	struct timespec now;
+	int i, n = grp->num_receivers;
+
+	while (!par->shutdown) {
+		if (par->sender) {
+			grp->remaining = n;
+
+			/* Broadcast: Start of latency measurement ... */
+			clock_gettime(CLOCK_MONOTONIC, &grp->sent);
+			if (tp->broadcast(par, grp)) {
+				snprintf(par->error, sizeof(par->error),
+				    "%s: could not broadcast: %s\n",
+				    tp->name, strerror(errno));
+				par->shutdown = 1;
+				break;
+			}
+			if (tp->wait_complete(par, grp)) {
+				if (!par->shutdown)
+					snprintf(par->error,
+					    sizeof(par->error),
+					    "%s: could not wait for "
+					    "completion: %s\n", tp->name,
+					    strerror(errno));
+				par->shutdown = 1;
+				break;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &now);
+
+			memcpy(grp->sorted, grp->woken, n * sizeof(long));
+			qsort(grp->sorted, n, sizeof(long), cmplong);
+			update_latency(&grp->first, grp->sorted[0]);
+			update_latency(&grp->median,
+			    percentile(grp->sorted, n, 50.0));
+			update_latency(&grp->last, grp->sorted[n - 1]);
+			update_latency(&grp->fanin,
+			    calcdiff(now, grp->completed));
+			par->samples++;
+
+			if (par->tracelimit &&
+			    grp->last.max > par->tracelimit) {
+				breaktrace(par);
+				par->shutdown = 1;
+			}
+			if (par->max_cycles && par->samples >= par->max_cycles)
+				par->shutdown = 1;
+			if (mustgetcpu)
+				par->cpu = get_cpu();
+			nanosleep(&par->delay, NULL);
+		} else {
+			/* Receiver */
+			if (tp->wait_broadcast(par, grp)) {
+				if (!par->shutdown)
+					snprintf(par->error,
+					    sizeof(par->error),
+					    "%s: could not wait for "
+					    "broadcast: %s\n", tp->name,
+					    strerror(errno));
+				par->shutdown = 1;
+				break;
+			}
+
+			/* ... Woken up: End of latency measurement */
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (par->shutdown)
+				break;
+			grp->woken[par->num] = calcdiff(now, grp->sent);
+			par->samples++;
+			if (mustgetcpu)
+				par->cpu = get_cpu();
+
+			i = __sync_sub_and_fetch(&grp->remaining, 1);
+			if (i == 0)
+				clock_gettime(CLOCK_MONOTONIC, &grp->completed);
+			if (tp->complete(par, grp, i == 0)) {
+				snprintf(par->error, sizeof(par->error),
+				    "%s: could not complete: %s\n",
+				    tp->name, strerror(errno));
+				par->shutdown = 1;
+			}
+		}
+	}
+
+	/* Let the receivers see the shutdown */
+	if (par->sender) {
+		for (i = 0; i < n; i++)
+			grp->receivers[i].shutdown = 1;
+		tp->broadcast(par, grp);
+	}
+	par->stopped = 1;
+	return NULL;
+}
+
+
+static void display_help(void)
+{
+	struct transport *tp;
+
+	printf("ipctest V %1.2f\n", VERSION_STRING);
+	puts("Usage: ipctest <options>");
+	puts("Function: test interprocess communication latency");
+	printf(
+	"Options:\n"
+	"-a [NUM] --affinity        run thread #N on processor #N, if possible\n"
+	"                           with NUM pin all threads to the processor NUM\n"
+	"-b USEC  --breaktrace=USEC send break trace command when latency > USEC\n"
+	"-d DIST  --distance=DIST   distance of thread intervals in us default=500\n"
+	"-F NUM   --fanout=NUM      wake NUM receivers with a single broadcast and\n"
+	"                           report first, median and last wakeup and the\n"
+	"                           fan-in latency, -t sets the number of groups\n"
+	"                           default transports=%s\n"
+	"-i INTV  --interval=INTV   base interval of thread in us default=1000\n"
+	"-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
+	"                           with -M, loops per CPU pair, default=%d\n"
+	"                           with several transports, loops per transport,\n"
+	"                           default=%d\n"
+	"-M LIST  --matrix=LIST     run the sender on CPU A and the receiver on\n"
+	"                           CPU B for every pair (A,B) of the cpu list\n"
+	"                           LIST, one pair at a time, and print a matrix\n"
+	"                           of median and 99th percentile latency\n"
+	"-p PRIO  --prio=PRIO       priority\n"
+	"-S       --smp             SMP testing: options -a -t and same priority\n"
+        "                           of all threads\n"
+	"-t       --threads         one thread per available processor\n"
+	"-t [NUM] --threads=NUM     number of threads:\n"
+	"                           without NUM, threads = max_cpus\n"
+	"                           without -t default = 1\n"
+	"-T LIST  --transport=LIST  comma separated list of transports to test,\n"
+	"                           every transport gets its own thread pairs,\n"
+	"                           the transports run one after another\n"
+	"                           default=all\n"
+	"Transports (* = supports -F):\n", FANOUT_TRANSPORTS, MATRIX_LOOPS,
+	TRANSPORT_LOOPS);
+	for (tp = transports; tp->name != NULL; tp++)
+		printf("%-8s%c%s\n", tp->name, tp->broadcast ? '*' : ' ',
+		    tp->description);
+	exit(1);
+}
+
+
+static int setaffinity = AFFINITY_UNSPECIFIED;
+static int affinity;
+static int tracelimit;
+static int priority;
+static int num_threads = 1;
+static int max_cycles;
+static int interval = 1000;
+static int distance = 500;
+static int smp;
+static int sameprio;
+static struct transport *use_transport[MAX_TRANSPORTS];
+static int num_transports;
+static int *matrix_cpus;
+static int num_matrix_cpus;
+static int fanout;
+
+static int parse_transports(char *list)
+{
+	char *name, *saveptr = NULL;
+	struct transport *tp;
+
+	num_transports = 0;
+	for (name = strtok_r(list, ",", &saveptr); name != NULL;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		if (!strcmp(name, "all")) {
+			for (tp = transports; tp->name != NULL &&
+			     num_transports < MAX_TRANSPORTS; tp++)
+				use_transport[num_transports++] = tp;
+			continue;
+		}
+		tp = find_transport(name);
+		if (tp == NULL) {
+			fprintf(stderr, "ERROR: unknown transport %s\n", name);
+			return -1;
+		}
+		if (num_transports == MAX_TRANSPORTS) {
+			fprintf(stderr, "ERROR: too many transports\n");
+			return -1;
+		}
+		use_transport[num_transports++] = tp;
+	}
+	return num_transports ? 0 : -1;
+}
+
+static void process_options (int argc, char *argv[])
+{
+	int error = 0;
+	int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	char *transportlist = NULL;
+
+	for (;;) {
+		int option_index = 0;
+		/** Options for getopt */
+		static struct option long_options[] = {
+			{"affinity", optional_argument, NULL, 'a'},
+			{"breaktrace", required_argument, NULL, 'b'},
+			{"distance", required_argument, NULL, 'd'},
+			{"fanout", required_argument, NULL, 'F'},
+			{"interval", required_argument, NULL, 'i'},
+			{"loops", required_argument, NULL, 'l'},
+			{"matrix", required_argument, NULL, 'M'},
+			{"priority", required_argument, NULL, 'p'},
+			{"smp", no_argument, NULL, 'S'},
+			{"threads", optional_argument, NULL, 't'},
+			{"transport", required_argument, NULL, 'T'},
+			{"help", no_argument, NULL, '?'},
+			{NULL, 0, NULL, 0}
+		};
+		int c = getopt_long (argc, argv, "a::b:d:F:i:l:M:p:St::T:",
+			long_options, &option_index);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'a':
+			if (smp) {
+				warn("-a ignored due to --smp\n");
+				break;
+			}
+			if (optarg != NULL) {
+				affinity = atoi(optarg);
+				setaffinity = AFFINITY_SPECIFIED;
+			} else if (optind<argc && atoi(argv[optind])) {
+				affinity = atoi(argv[optind]);
+				setaffinity = AFFINITY_SPECIFIED;
+			} else {
+				setaffinity = AFFINITY_USEALL;
+			}
+			break;
+		case 'b': tracelimit = atoi(optarg); break;
+		case 'd': distance = atoi(optarg); break;
+		case 'F': fanout = atoi(optarg); break;
+		case 'i': interval = atoi(optarg); break;
+		case 'l': max_cycles = atoi(optarg); break;
+		case 'M':
+			matrix_cpus = calloc(max_cpus, sizeof(int));
+			if (matrix_cpus == NULL)
+				fatal("could not allocate cpu list\n");
+			num_matrix_cpus = parse_cpulist(optarg, matrix_cpus,
+			    max_cpus);
+			if (num_matrix_cpus < 1) {
+				fprintf(stderr, "ERROR: invalid cpu list %s, "
+				    "only %d CPUs available\n", optarg,
+				    max_cpus);
+				error = 1;
+			}
+			break;
+		case 'p': priority = atoi(optarg); break;
+		case 'S':
+			smp = 1;
+			num_threads = max_cpus;
+			setaffinity = AFFINITY_USEALL;
+			break;
+		case 't':
+			if (smp) {
+				warn("-t ignored due to --smp\n");
+				break;
+			}
+			if (optarg != NULL)
+				num_threads = atoi(optarg);
+			else if (optind<argc && atoi(argv[optind]))
+				num_threads = atoi(argv[optind]);
+			else
+				num_threads = max_cpus;
+			break;
+		case 'T': transportlist = optarg; break;
+		case '?': error = 1; break;
+		}
+	}
+
+	if (setaffinity == AFFINITY_SPECIFIED) {
+		if (affinity < 0)
+			error = 1;
+		if (affinity >= max_cpus) {
+			fprintf(stderr, "ERROR: CPU #%d not found, only %d CPUs available\n",
+			    affinity, max_cpus);
+			error = 1;
+		}
+	}
+
+	/* strtok_r() writes into the list, it must not be a literal */
+	transportlist = strdup(transportlist != NULL ? transportlist :
+	    fanout ? FANOUT_TRANSPORTS : "all");
+	if (transportlist == NULL || parse_transports(transportlist))
+		error = 1;
+	free(transportlist);
+
+	if (fanout) {
+		int i;
+
+		if (fanout < 1 || fanout > 255 || num_matrix_cpus)
+			error = 1;
+		for (i = 0; i < num_transports; i++) {
+			if (use_transport[i]->broadcast == NULL) {
+				fprintf(stderr, "ERROR: transport %s does not "
+				    "support -F\n", use_transport[i]->name);
+				error = 1;
+			}
+		}
+	}
+
+	if (num_threads < 0 || num_threads > 255)
+		error = 1;
+
+	if (priority < 0 || priority > 99)
+		error = 1;
+
+	if (num_threads < 1)
+		error = 1;
+
+	if (priority && smp)
+		sameprio = 1;
+
+	if (num_matrix_cpus && !max_cycles)
+		max_cycles = MATRIX_LOOPS;
+
+	/* The transports run one after another, the first must end */
+	if (!num_matrix_cpus && num_transports > 1 && !max_cycles)
+		max_cycles = TRANSPORT_LOOPS;
+
+	if (error)
+		display_help ();
+}
+
+
+static int volatile mustshutdown;
+
+static void sighand(int sig)
+{
+	mustshutdown = 1;
+}
+
+static void print_matrix(struct transport *tp, char *title, long *result)
+{
+	int a, b;
+
+	printf("# %s %s latency (us), sender CPU in rows, receiver CPU "
+	    "in columns\n#      ", tp->name, title);
+	for (b = 0; b < num_matrix_cpus; b++)
+		printf(" %6d", matrix_cpus[b]);
+	printf("\n");
+	for (a = 0; a < num_matrix_cpus; a++) {
+		printf("%7d", matrix_cpus[a]);
+		for (b = 0; b < num_matrix_cpus; b++) {
+			long val = result[a * num_matrix_cpus + b];
+
+			if (val < 0)
+				printf("      -");
+			else
+				printf(" %6ld", val);
+		}
+		printf("\n");
+	}
+}
+
+/*
+ * Run a single pair with the sender on sendcpu and the receiver on
+ * recvcpu until max_cycles samples are taken. The samples are stored in
+ * values. Return the number of samples, or -1 if we were interrupted.
+ */
+static int run_matrix_pair(struct transport *tp, int sendcpu, int recvcpu,
+			   long *values)
+{
+	struct params *receiver, *sender;
+	struct channel *channels;
+	struct timespec timeout;
+	int samples;
+
+	/* Not freed if interrupted, the threads might still use it */
+	receiver = calloc(2, sizeof(struct params));
+	channels = calloc(2, sizeof(struct channel));
+	if (receiver == NULL || channels == NULL)
+		fatal("could not allocate thread pair\n");
+	sender = receiver + 1;
+
+	if (tp->init(&channels[0], 0, CHANNEL_TEST) ||
+	    tp->init(&channels[1], 0, CHANNEL_SYNC))
+		fatal("could not initialize %s transport: %s\n", tp->name,
+		    strerror(errno));
+
+	receiver->mindiff = UINT_MAX;
+	receiver->cpu = recvcpu;
+	receiver->priority = priority;
+	receiver->tracelimit = tracelimit;
+	receiver->delay.tv_sec = interval / USEC_PER_SEC;
+	receiver->delay.tv_nsec = (interval % USEC_PER_SEC) * 1000;
+	receiver->max_cycles = max_cycles;
+	receiver->transport = tp;
+	receiver->test = &channels[0];
+	receiver->sync = &channels[1];
+	receiver->values = values;
+	receiver->neighbor = sender;
+	pthread_create(&receiver->threadid, NULL, ipcthread, receiver);
+	memcpy(sender, receiver, sizeof(*receiver));
+	sender->sender = 1;
+	sender->cpu = sendcpu;
+	sender->values = NULL;
+	sender->neighbor = receiver;
+	pthread_create(&sender->threadid, NULL, ipcthread, sender);
+
+	for (;;) {
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += 50000000; /* 50 ms */
+		if (timeout.tv_nsec >= NSEC_PER_SEC) {
+			timeout.tv_nsec -= NSEC_PER_SEC;
+			timeout.tv_sec++;
+		}
+		if (pthread_timedjoin_np(receiver->threadid, NULL,
+		    &timeout) == 0)
+			break;
+		if (mustshutdown) {
+			receiver->shutdown = 1;
+			sender->shutdown = 1;
+			pthread_kill(receiver->threadid, SIGTERM);
+			pthread_kill(sender->threadid, SIGTERM);
+			return -1;
+		}
+	}
+	pthread_join(sender->threadid, NULL);
+
+	if (receiver->error[0] != '\0')
+		fprintf(stderr, "%s", receiver->error);
+	if (sender->error[0] != '\0')
+		fprintf(stderr, "%s", sender->error);
+
+	samples = receiver->samples;
+	tp->cleanup(&channels[0], 0, CHANNEL_TEST);
+	tp->cleanup(&channels[1], 0, CHANNEL_SYNC);
+	free(channels);
+	free(receiver);
+	return samples;
+}
+
+static int run_matrix(void)
+{
+	int a, b, t, n = num_matrix_cpus;
+	long *values, *median, *p99;
+
+	values = calloc(max_cycles, sizeof(long));
+	median = calloc(n * n, sizeof(long));
+	p99 = calloc(n * n, sizeof(long));
+	if (values == NULL || median == NULL || p99 == NULL)
+		fatal("could not allocate matrix\n");
+
+	for (t = 0; t < num_transports && !mustshutdown; t++) {
+		struct transport *tp = use_transport[t];
+
+		for (a = 0; a < n * n; a++)
+			median[a] = p99[a] = -1;
+
+		for (a = 0; a < n && !mustshutdown; a++) {
+			for (b = 0; b < n && !mustshutdown; b++) {
+				int samples;
+
+				samples = run_matrix_pair(tp, matrix_cpus[a],
+				    matrix_cpus[b], values);
+				if (samples <= 0)
+					continue;
+				qsort(values, samples, sizeof(long), cmplong);
+				median[a * n + b] = percentile(values,
+				    samples, 50.0);
+				p99[a * n + b] = percentile(values,
+				    samples, 99.0);
+			}
+		}
+		print_matrix(tp, "median", median);
+		print_matrix(tp, "p99", p99);
+	}
+
+	free(p99);
+	free(median);
+	free(values);
+	return 0;
+}
+
+static void print_latency(int num, char *name, char *title,
+			  struct latency *lat, int samples)
+{
+	printf("#%d: %-7s %-6s Min %4d, Cur %4d, Avg %4d, Max %4d\n",
+	    num, name, title, lat->min, (int) lat->cur,
+	    (int) ((lat->sum / samples) + 0.5), lat->max);
+}
+
+static void init_latency(struct latency *lat)
+{
+	lat->min = UINT_MAX;
+	lat->max = 0;
+	lat->sum = 0.0;
+}
+
+/*
+ * Fan-out mode: num_threads groups of a transport, each with one sender
+ * and fanout receivers. Like the pairs, the transports run one after
+ * another. Return -1 if we were interrupted or a group did not stop.
+ */
+static int run_fanout(struct transport *tp)
+{
+	int g, k, stop = 0, num_groups = num_threads;
+	int prio = priority, intv = interval;
+	int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	int oldsamples = 1;
+	struct group *groups;
+	struct params *sender, *receivers;
+	sigset_t sigset;
+	struct timespec maindelay;
+
+	groups = calloc(num_groups, sizeof(struct group));
+	sender = calloc(num_groups, sizeof(struct params));
+	receivers = calloc(num_groups * fanout, sizeof(struct params));
+	if (groups == NULL || sender == NULL || receivers == NULL)
+		fatal("could not allocate thread groups\n");
+
+	for (g = 0; g < num_groups; g++) {
+		struct group *grp = &groups[g];
+		struct params *par = &sender[g];
+
+		grp->num_receivers = fanout;
+		grp->receivers = &receivers[g * fanout];
+		grp->woken = calloc(fanout, sizeof(long));
+		grp->sorted = calloc(fanout, sizeof(long));
+		if (grp->woken == NULL || grp->sorted == NULL)
+			fatal("could not allocate thread groups\n");
+		init_latency(&grp->first);
+		init_latency(&grp->median);
+		init_latency(&grp->last);
+		init_latency(&grp->fanin);
+		if (tp->group_init(grp))
+			fatal("could not initialize %s transport: %s\n",
+			    tp->name, strerror(errno));
+
+		par->num = g;
+		switch (setaffinity) {
+		case AFFINITY_UNSPECIFIED: par->cpu = -1; break;
+		case AFFINITY_SPECIFIED: par->cpu = affinity; break;
+		case AFFINITY_USEALL: par->cpu = g % max_cpus; break;
+		}
+		par->priority = prio;
+		par->tracelimit = tracelimit;
+		if (prio > 1 && !sameprio)
+			prio--;
+		par->delay.tv_sec = intv / USEC_PER_SEC;
+		par->delay.tv_nsec = (intv % USEC_PER_SEC) * 1000;
+		intv += distance;
+		par->max_cycles = max_cycles;
+		par->transport = tp;
+		par->group = grp;
+
+		for (k = 0; k < fanout; k++) {
+			struct params *rcv = &grp->receivers[k];
+
+			memcpy(rcv, par, sizeof(*par));
+			rcv->num = k;
+			if (setaffinity == AFFINITY_USEALL)
+				rcv->cpu = k % max_cpus;
+			pthread_create(&rcv->threadid, NULL, fanoutthread, rcv);
+		}
+		par->sender = 1;
+		pthread_create(&par->threadid, NULL, fanoutthread, par);
+	}
+
+	maindelay.tv_sec = 0;
+	maindelay.tv_nsec = 50000000; /* 50 ms */
+
+	while (!stop) {
+		int printed;
+		int errorlines = 0;
+
+		stop = mustshutdown;
+		for (g = 0; g < num_groups; g++) {
+			stop |= sender[g].shutdown;
+			for (k = 0; k < fanout; k++)
+				stop |= groups[g].receivers[k].shutdown;
+		}
+
+		if (sender[0].samples > oldsamples || stop) {
+			for (g = 0; g < num_groups; g++) {
+				struct group *grp = &groups[g];
+				struct params *par = &sender[g];
+				char *name = tp->name;
+
+				printf("#%d: %-7s ID%d, P%d, CPU%d, I%ld, "
+				    "Receivers %d, Cycles %d\n", g, name,
+				    par->tid, par->priority, par->cpu,
+				    par->delay.tv_nsec / 1000, fanout,
+				    par->samples);
+				if (par->samples == 0) {
+					printf("#%d: %-7s (not yet ready)\n"
+					    "\n\n\n", g, name);
+				} else {
+					print_latency(g, name, "first",
+					    &grp->first, par->samples);
+					print_latency(g, name, "median",
+					    &grp->median, par->samples);
+					print_latency(g, name, "last",
+					    &grp->last, par->samples);
+					print_latency(g, name, "fan-in",
+					    &grp->fanin, par->samples);
+				}
+				if (par->error[0] != '\0') {
+					printf("%s", par->error);
+					errorlines++;
+					par->error[0] = '\0';
+				}
+				for (k = 0; k < fanout; k++) {
+					struct params *rcv = &grp->receivers[k];
+
+					if (rcv->error[0] != '\0') {
+						printf("%s", rcv->error);
+						errorlines++;
+						rcv->error[0] = '\0';
+					}
+				}
+			}
+			printed = 1;
+		} else
+			printed = 0;
+
+		sigemptyset(&sigset);
+		sigaddset(&sigset, SIGTERM);
+		sigaddset(&sigset, SIGINT);
+		pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+		if (!stop)
+			nanosleep(&maindelay, NULL);
+
+		pthread_sigmask(SIG_UNBLOCK, &sigset, NULL);
+
+		if (printed && !stop)
+			printf("\033[%dA", num_groups*5 + errorlines);
+	}
+
+	/* The senders pass the shutdown on to their receivers */
+	for (g = 0; g < num_groups; g++)
+		sender[g].shutdown = 1;
+	nanosleep(&sender[num_groups-1].delay, NULL);
+
+	for (g = 0; g < num_groups; g++) {
+		if (!sender[g].stopped)
+			pthread_kill(sender[g].threadid, SIGTERM);
+		for (k = 0; k < fanout; k++) {
+			struct params *rcv = &groups[g].receivers[k];
+
+			if (!rcv->stopped)
+				pthread_kill(rcv->threadid, SIGTERM);
+		}
+	}
+	nanosleep(&maindelay, NULL);
+
+	/* Not freed if a thread is left, it might still use it */
+	for (g = 0; g < num_groups; g++) {
+		if (!sender[g].stopped)
+			return -1;
+		for (k = 0; k < fanout; k++) {
+			if (!groups[g].receivers[k].stopped)
+				return -1;
+		}
+	}
+	for (g = 0; g < num_groups; g++) {
+		struct group *grp = &groups[g];
+
+		pthread_join(sender[g].threadid, NULL);
+		for (k = 0; k < fanout; k++)
+			pthread_join(grp->receivers[k].threadid, NULL);
+		tp->group_cleanup(grp);
+		free(grp->sorted);
+		free(grp->woken);
+	}
+	free(receivers);
+	free(sender);
+	free(groups);
+	return mustshutdown ? -1 : 0;
+}
+
+/*
+ * Run num_threads pairs of a transport until one of them has taken
+ * max_cycles samples. The transports run one after another, so that they
+ * do not compete for the CPUs and each other's wakeups. Return -1 if we
+ * were interrupted or a pair did not stop, its threads might still use it.
+ */
+static int run_pairs(struct transport *tp)
+{
+	int i, stop = 0, num_pairs = num_threads;
+	int prio = priority, intv = interval;
+	int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	int oldsamples = 1;
+	struct params *receiver, *sender;
+	struct channel *channels;
+	sigset_t sigset;
+	struct timespec maindelay;
+
+	receiver = calloc(num_pairs, sizeof(struct params));
+	sender = calloc(num_pairs, sizeof(struct params));
+	channels = calloc(num_pairs * 2, sizeof(struct channel));
+	if (receiver == NULL || sender == NULL || channels == NULL)
+		fatal("could not allocate thread pairs\n");
+
+	for (i = 0; i < num_pairs; i++) {
+		if (tp->init(&channels[i*2], i, CHANNEL_TEST) ||
+		    tp->init(&channels[i*2+1], i, CHANNEL_SYNC))
+			fatal("could not initialize %s transport: %s\n",
+			    tp->name, strerror(errno));
+
+		receiver[i].mindiff = UINT_MAX;
+		receiver[i].maxdiff = 0;
+		receiver[i].sumdiff = 0.0;
+
+		receiver[i].num = i;
+		switch (setaffinity) {
+		case AFFINITY_UNSPECIFIED: receiver[i].cpu = -1; break;
+		case AFFINITY_SPECIFIED: receiver[i].cpu = affinity; break;
+		case AFFINITY_USEALL: receiver[i].cpu = i % max_cpus; break;
+		}
+		receiver[i].priority = prio;
+		receiver[i].tracelimit = tracelimit;
+		if (prio > 1 && !sameprio)
+			prio--;
+		receiver[i].delay.tv_sec = intv / USEC_PER_SEC;
+		receiver[i].delay.tv_nsec = (intv % USEC_PER_SEC) * 1000;
+		intv += distance;
+		receiver[i].max_cycles = max_cycles;
+		receiver[i].transport = tp;
+		receiver[i].test = &channels[i*2];
+		receiver[i].sync = &channels[i*2+1];
+		receiver[i].sender = 0;
+		receiver[i].neighbor = &sender[i];
+		pthread_create(&receiver[i].threadid, NULL, ipcthread, &receiver[i]);
+		memcpy(&sender[i], &receiver[i], sizeof(receiver[0]));
+		sender[i].sender = 1;
+		sender[i].neighbor = &receiver[i];
+		pthread_create(&sender[i].threadid, NULL, ipcthread, &sender[i]);
+	}
+
+	maindelay.tv_sec = 0;
+	maindelay.tv_nsec = 50000000; /* 50 ms */
+
+	while (!stop) {
+		int printed;
+		int errorlines = 0;
+
+		stop = mustshutdown;
+		for (i = 0; i < num_pairs; i++)
+			stop |= receiver[i].shutdown | sender[i].shutdown;
+
+		if (receiver[0].samples > oldsamples || stop) {
+			for (i = 0; i < num_pairs; i++) {
+				printf("#%1d: ID%d, P%d, CPU%d, I%ld; #%1d: ID%d, P%d, CPU%d, Cycles %d\n",
+				    i*2, receiver[i].tid, receiver[i].priority, receiver[i].cpu,
+				    receiver[i].delay.tv_nsec / 1000,
+				    i*2+1, sender[i].tid, sender[i].priority, sender[i].cpu,
+				    sender[i].samples);
+			}
+			for (i = 0; i < num_pairs; i++) {
+				if (receiver[i].samples == 0)
+					printf("#%d -> #%d, %-7s (not yet ready)\n",
+					    i*2+1, i*2, tp->name);
+				else
+					printf("#%d -> #%d, %-7s Min %4d, Cur %4d, Avg %4d, Max %4d\n",
+					    i*2+1, i*2, tp->name,
+					    receiver[i].mindiff, (int) receiver[i].diff,
+					    (int) ((receiver[i].sumdiff / receiver[i].samples) + 0.5),
+					    receiver[i].maxdiff);
+				if (receiver[i].error[0] != '\0') {
+					printf("%s", receiver[i].error);
+					errorlines++;
+					receiver[i].error[0] = '\0';
+				}
+				if (sender[i].error[0] != '\0') {
+					printf("%s", sender[i].error);
+					errorlines++;
+					sender[i].error[0] = '\0';
+				}
+			}
+			printed = 1;
+		} else
+			printed = 0;
+
+		sigemptyset(&sigset);
+		sigaddset(&sigset, SIGTERM);
+		sigaddset(&sigset, SIGINT);
+		pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+		if (!stop)
+			nanosleep(&maindelay, NULL);
+
+		pthread_sigmask(SIG_UNBLOCK, &sigset, NULL);
+
+		if (printed && !stop)
+			printf("\033[%dA", num_pairs*2 + errorlines);
+	}
+
+	for (i = 0; i < num_pairs; i++) {
+		receiver[i].shutdown = 1;
+		sender[i].shutdown = 1;
+	}
+	nanosleep(&receiver[num_pairs-1].delay, NULL);
+
+	for (i = 0; i < num_pairs; i++) {
+		if (!receiver[i].stopped)
+			pthread_kill(receiver[i].threadid, SIGTERM);
+		if (!sender[i].stopped)
+			pthread_kill(sender[i].threadid, SIGTERM);
+	}
+	nanosleep(&maindelay, NULL);
+
+	/* Not freed if a thread is left, it might still use it */
+	for (i = 0; i < num_pairs; i++) {
+		if (!receiver[i].stopped || !sender[i].stopped)
+			return -1;
+	}
+	for (i = 0; i < num_pairs; i++) {
+		pthread_join(receiver[i].threadid, NULL);
+		pthread_join(sender[i].threadid, NULL);
+		tp->cleanup(&channels[i*2], i, CHANNEL_TEST);
+		tp->cleanup(&channels[i*2+1], i, CHANNEL_SYNC);
+	}
+	free(channels);
+	free(sender);
+	free(receiver);
+	return mustshutdown ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int t;
+	sigset_t sigset;
+
+	process_options(argc, argv);
+
+	if (check_privs())
+		return 1;
+
+	if (mlockall(MCL_CURRENT|MCL_FUTURE) == -1) {
+		perror("mlockall");
+		return 1;
+	}
+
+	get_cpu_setup();
+
+	signal(SIGINT, sighand);
+	signal(SIGTERM, sighand);
+
+	/* The signal transport receives them with sigwait() */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGUSR1);
+	sigaddset(&sigset, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	if (num_matrix_cpus)
+		return run_matrix();
+
+	for (t = 0; t < num_transports; t++) {
+		if (fanout ? run_fanout(use_transport[t]) :
+		    run_pairs(use_transport[t]))
+			break;
+	}
+
+	return 0;
+}
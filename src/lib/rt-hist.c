@@ -0,0 +1,105 @@
+/*
+ * Latency histograms of the IPC tests, see rt-hist.h
+ *
+ * The output format is the one of cyclictest -h.
+ */
+
+#include <stdio.h>
+#include "rt-hist.h"
+
+void rt_hist_add(struct rt_hist *hist, int buckets, unsigned long value)
+{
+	if (hist->count == 0 || value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+	hist->sum += value;
+	hist->count++;
+	if (value >= buckets)
+		hist->overflow++;
+	else
+		hist->bucket[value]++;
+}
+
+/* Add the samples of src to dst, e.g. to sum up the receivers of a run */
+void rt_hist_merge(struct rt_hist *dst, struct rt_hist *src, int buckets)
+{
+	int i;
+
+	if (src->count == 0)
+		return;
+	if (dst->count == 0 || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->sum += src->sum;
+	dst->count += src->count;
+	dst->overflow += src->overflow;
+	for (i = 0; i < buckets; i++)
+		dst->bucket[i] += src->bucket[i];
+}
+
+/*
+ * Smallest latency that at least per mille of the samples do not exceed.
+ * If it is beyond the last bucket, the maximum is the best we know.
+ */
+unsigned long rt_hist_percentile(struct rt_hist *hist, int buckets,
+				 int per_mille)
+{
+	unsigned long long need, sum = 0;
+	int i;
+
+	need = ((unsigned long long) hist->count * per_mille + 999) / 1000;
+	for (i = 0; i < buckets; i++) {
+		sum += hist->bucket[i];
+		if (sum >= need)
+			return i;
+	}
+	return hist->max;
+}
+
+void rt_hist_print(struct rt_hist *hist[], int nhist, int buckets)
+{
+	static const int per_mille[] = { 500, 900, 990, 999 };
+	int i, j;
+
+	printf("# Histogram\n");
+	for (i = 0; i < buckets; i++) {
+		printf("%06d ", i);
+		for (j = 0; j < nhist; j++) {
+			printf("%06lu", hist[j]->bucket[i]);
+			if (j < nhist - 1)
+				printf("\t");
+		}
+		printf("\n");
+	}
+	printf("# Total:");
+	for (j = 0; j < nhist; j++)
+		printf(" %09lu", hist[j]->count - hist[j]->overflow);
+	printf("\n");
+	printf("# Min Latencies:");
+	for (j = 0; j < nhist; j++)
+		printf(" %05lu", hist[j]->min);
+	printf("\n");
+	printf("# Avg Latencies:");
+	for (j = 0; j < nhist; j++)
+		printf(" %05lu", hist[j]->count ?
+		       (unsigned long) (hist[j]->sum / hist[j]->count) : 0);
+	printf("\n");
+	printf("# Max Latencies:");
+	for (j = 0; j < nhist; j++)
+		printf(" %05lu", hist[j]->max);
+	printf("\n");
+	for (i = 0; i < sizeof(per_mille) / sizeof(per_mille[0]); i++) {
+		printf("# %d.%dth Percentile:", per_mille[i] / 10,
+		       per_mille[i] % 10);
+		for (j = 0; j < nhist; j++)
+			printf(" %05lu", rt_hist_percentile(hist[j], buckets,
+							    per_mille[i]));
+		printf("\n");
+	}
+	printf("# Histogram Overflows:");
+	for (j = 0; j < nhist; j++)
+		printf(" %05lu", hist[j]->overflow);
+	printf("\n");
+}
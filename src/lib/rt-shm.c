@@ -0,0 +1,161 @@
+/*
+ * Shared memory layout for the fork mode of the IPC tests, see rt-shm.h
+ *
+ * based on the fork mode of sigwaittest and svsematest that has
+ * (C) 2009 Carsten Emde <C.Emde@osadl.org>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "rt-shm.h"
+
+#define ROUNDUP(x) (((x) + RT_SHM_CACHELINE - 1) & ~(RT_SHM_CACHELINE - 1))
+
+static struct rt_shm_header *header(struct rt_shm *shm)
+{
+	return shm->base;
+}
+
+/*
+ * Create the region. With a name, it is a POSIX shared memory object
+ * that exec'ed children can attach to, without a name it is an anonymous
+ * shared mapping for threads. Return 0, or -1 with errno set.
+ */
+int rt_shm_create(struct rt_shm *shm, char *name, int num_pairs,
+		  size_t params_size, size_t hist_size, size_t sync_size)
+{
+	struct rt_shm_header *hdr;
+	size_t size[RT_SHM_NUM_AREAS];
+	size_t offset;
+	int i, fd = -1;
+
+	/* The tests index their params arrays, slots cannot be padded */
+	if (params_size % RT_SHM_CACHELINE || num_pairs < 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size[RT_SHM_RECEIVER] = params_size;
+	size[RT_SHM_SENDER] = params_size;
+	size[RT_SHM_STAMP] = sizeof(struct rt_shm_stamp);
+	size[RT_SHM_HIST] = ROUNDUP(hist_size);
+	size[RT_SHM_SYNC] = ROUNDUP(sync_size);
+
+	shm->size = sizeof(struct rt_shm_header);
+	for (i = 0; i < RT_SHM_NUM_AREAS; i++)
+		shm->size += num_pairs * size[i];
+
+	if (name != NULL) {
+		shm_unlink(name);
+		fd = shm_open(name, O_CREAT|O_EXCL|O_RDWR, S_IRUSR|S_IWUSR);
+		if (fd < 0)
+			return -1;
+		if (ftruncate(fd, shm->size)) {
+			close(fd);
+			shm_unlink(name);
+			return -1;
+		}
+		shm->base = mmap(0, shm->size, PROT_READ|PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+		close(fd);
+	} else
+		shm->base = mmap(0, shm->size, PROT_READ|PROT_WRITE,
+		    MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (shm->base == MAP_FAILED) {
+		if (name != NULL)
+			shm_unlink(name);
+		return -1;
+	}
+	memset(shm->base, 0, shm->size);
+	shm->name = name;
+
+	hdr = header(shm);
+	hdr->magic = RT_SHM_MAGIC;
+	hdr->version = RT_SHM_VERSION;
+	hdr->num_pairs = num_pairs;
+	hdr->total_size = shm->size;
+	offset = sizeof(struct rt_shm_header);
+	for (i = 0; i < RT_SHM_NUM_AREAS; i++) {
+		hdr->size[i] = size[i];
+		hdr->offset[i] = offset;
+		offset += num_pairs * size[i];
+	}
+	return 0;
+}
+
+/*
+ * Attach to a region created by the parent. Return 0, or -1 with errno
+ * set, errno is EPROTO if the layout does not match ours. The size of the
+ * histograms is chosen by the parent and not checked here.
+ */
+int rt_shm_attach(struct rt_shm *shm, char *name, size_t params_size,
+		  size_t sync_size)
+{
+	struct rt_shm_header *hdr;
+	struct stat buf;
+	int fd;
+
+	fd = shm_open(name, O_RDWR, S_IRUSR|S_IWUSR);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &buf)) {
+		close(fd);
+		return -1;
+	}
+	if (buf.st_size < sizeof(struct rt_shm_header)) {
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+	shm->size = buf.st_size;
+	shm->base = mmap(0, shm->size, PROT_READ|PROT_WRITE, MAP_SHARED,
+	    fd, 0);
+	close(fd);
+	if (shm->base == MAP_FAILED)
+		return -1;
+	shm->name = NULL;
+
+	hdr = header(shm);
+	if (hdr->magic != RT_SHM_MAGIC || hdr->version != RT_SHM_VERSION ||
+	    hdr->total_size != shm->size ||
+	    hdr->size[RT_SHM_RECEIVER] != params_size ||
+	    hdr->size[RT_SHM_SENDER] != params_size ||
+	    hdr->size[RT_SHM_STAMP] != sizeof(struct rt_shm_stamp) ||
+	    hdr->size[RT_SHM_SYNC] != ROUNDUP(sync_size)) {
+		rt_shm_detach(shm);
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+void rt_shm_detach(struct rt_shm *shm)
+{
+	munmap(shm->base, shm->size);
+	shm->base = NULL;
+}
+
+/* Detach and remove the shared memory object, if it has a name */
+void rt_shm_destroy(struct rt_shm *shm)
+{
+	rt_shm_detach(shm);
+	if (shm->name != NULL)
+		shm_unlink(shm->name);
+}
+
+int rt_shm_num_pairs(struct rt_shm *shm)
+{
+	return header(shm)->num_pairs;
+}
+
+void *rt_shm_slot(struct rt_shm *shm, int area, int num)
+{
+	struct rt_shm_header *hdr = header(shm);
+
+	return (char *) shm->base + hdr->offset[area] + num * hdr->size[area];
+}
@@ -0,0 +1,130 @@
+/*
+ * Signal receive modes of sigwaittest and signaltest, see rt-signal.h
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
+#include "rt-signal.h"
+
+char *rt_signal_mode_names[RT_SIGNAL_NUM_MODES] = {
+	[RT_SIGNAL_SIGWAIT] = "sigwait",
+	[RT_SIGNAL_SIGWAITINFO] = "sigwaitinfo",
+	[RT_SIGNAL_SIGTIMEDWAIT] = "sigtimedwait",
+	[RT_SIGNAL_SIGNALFD] = "signalfd",
+};
+
+/* Return the mode of the given name, or -1 */
+int rt_signal_parse_mode(char *name)
+{
+	int i;
+
+	for (i = 0; i < RT_SIGNAL_NUM_MODES; i++)
+		if (!strcmp(name, rt_signal_mode_names[i]))
+			return i;
+	return -1;
+}
+
+/*
+ * Block sig in the calling thread and prepare to receive it in the given
+ * mode. In signalfd mode, the signalfd sits in an epoll set of its own,
+ * like in an event loop. Return 0, or -1 with errno set.
+ */
+int rt_signal_init(struct rt_signal_waiter *w, int mode, int sig)
+{
+	struct epoll_event ev;
+
+	w->mode = mode;
+	w->fd = -1;
+	w->epfd = -1;
+	sigemptyset(&w->set);
+	sigaddset(&w->set, sig);
+	if (pthread_sigmask(SIG_BLOCK, &w->set, NULL))
+		return -1;
+	if (mode != RT_SIGNAL_SIGNALFD)
+		return 0;
+
+	w->fd = signalfd(-1, &w->set, SFD_CLOEXEC);
+	if (w->fd < 0)
+		return -1;
+	w->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (w->epfd < 0)
+		goto err;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = w->fd;
+	if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->fd, &ev))
+		goto err;
+	return 0;
+err:
+	rt_signal_cleanup(w);
+	return -1;
+}
+
+/*
+ * Wait for the signal. Return the signal number, 0 on timeout or if
+ * interrupted by another signal, or -1 with errno set. The payload of a
+ * queued signal is stored in *payload, it is 0 in sigwait mode.
+ */
+int rt_signal_wait(struct rt_signal_waiter *w, uintptr_t *payload)
+{
+	struct timespec timeout;
+	struct signalfd_siginfo fdsi;
+	struct epoll_event ev;
+	siginfo_t info;
+	int sig, ret;
+
+	*payload = 0;
+	switch (w->mode) {
+	case RT_SIGNAL_SIGWAIT:
+		ret = sigwait(&w->set, &sig);
+		if (ret) {
+			errno = ret;
+			return -1;
+		}
+		return sig;
+
+	case RT_SIGNAL_SIGWAITINFO:
+		sig = sigwaitinfo(&w->set, &info);
+		break;
+
+	case RT_SIGNAL_SIGTIMEDWAIT:
+		timeout.tv_sec = RT_SIGNAL_TIMEOUT_MS / 1000;
+		timeout.tv_nsec = (RT_SIGNAL_TIMEOUT_MS % 1000) * 1000000;
+		sig = sigtimedwait(&w->set, &info, &timeout);
+		break;
+
+	case RT_SIGNAL_SIGNALFD:
+		ret = epoll_wait(w->epfd, &ev, 1, RT_SIGNAL_TIMEOUT_MS);
+		if (ret <= 0)
+			return ret < 0 && errno != EINTR ? -1 : 0;
+		ret = read(w->fd, &fdsi, sizeof(fdsi));
+		if (ret != sizeof(fdsi))
+			return ret < 0 && errno != EAGAIN && errno != EINTR ?
+			    -1 : 0;
+		*payload = (uintptr_t) fdsi.ssi_ptr;
+		return fdsi.ssi_signo;
+
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (sig < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	*payload = (uintptr_t) info.si_value.sival_ptr;
+	return sig;
+}
+
+void rt_signal_cleanup(struct rt_signal_waiter *w)
+{
+	if (w->epfd >= 0)
+		close(w->epfd);
+	if (w->fd >= 0)
+		close(w->fd);
+	w->epfd = -1;
+	w->fd = -1;
+}
@@ -22,7 +22,7 @@
 static char debugfileprefix[MAX_PATH];
 
 /*
- * Finds the tracing directory in a mounted debugfs
+ * Finds the tracing directory in a mounted tracefs or debugfs
  */
 char *get_debugfileprefix(void)
 {
@@ -35,6 +35,12 @@ char *get_debugfileprefix(void)
 	if (debugfileprefix[0] != '\0')
 		goto out;
 
+	/* newer kernels mount tracefs on its own, without debugfs */
+	if (stat("/sys/kernel/tracing/tracing_on", &s) == 0) {
+		strcpy(debugfileprefix, "/sys/kernel/tracing/");
+		goto out;
+	}
+
 	/* look in the "standard" mount point first */
 	if ((stat("/sys/kernel/debug/tracing", &s) == 0) && S_ISDIR(s.st_mode)) {
 		strcpy(debugfileprefix, "/sys/kernel/debug/tracing/");
@@ -273,3 +279,82 @@ int check_privs(void)
 	return sched_setscheduler(0, policy, &old_param);
 }
 
+/*
+ * parse a cpu list like "0-3,8,10-11" into an array of cpu numbers,
+ * duplicates are dropped, cpus must have room for maxcpus entries
+ * return the number of cpus, or -1 if the list is malformed or
+ * contains a cpu >= maxcpus
+ */
+int parse_cpulist(char *str, int *cpus, int maxcpus)
+{
+	char *p = str;
+	int num = 0;
+
+	while (*p != '\0') {
+		char *end;
+		long first, last, cpu;
+
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0)
+			return -1;
+		last = first;
+		p = end;
+		if (*p == '-') {
+			p++;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return -1;
+			p = end;
+		}
+		if (last >= maxcpus)
+			return -1;
+		for (cpu = first; cpu <= last; cpu++) {
+			int i;
+
+			/* ignore duplicates */
+			for (i = 0; i < num; i++)
+				if (cpus[i] == cpu)
+					break;
+			if (i == num)
+				cpus[num++] = cpu;
+		}
+		if (*p == ',')
+			p++;
+		else if (*p != '\0')
+			return -1;
+	}
+	return num;
+}
+
+/*
+ * parse an input value as a base10 value followed by an optional
+ * suffix. The input value is presumed to be in seconds, unless
+ * followed by a modifier suffix: m=minutes, h=hours, d=days
+ *
+ * the return value is a value in seconds
+ */
+int parse_time_string(char *val)
+{
+	char *end;
+	int t = strtol(val, &end, 10);
+	if (end) {
+		switch (*end) {
+		case 'm':
+		case 'M':
+			t *= 60;
+			break;
+
+		case 'h':
+		case 'H':
+			t *= 60*60;
+			break;
+
+		case 'd':
+		case 'D':
+			t *= 24*60*60;
+			break;
+
+		}
+	}
+	return t;
+}
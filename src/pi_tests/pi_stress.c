@@ -55,6 +55,8 @@
 #include <sys/wait.h>
 #include <termios.h>
 
+#include "rt-hist.h"
+
 /* conversions */
 #define USEC_PER_SEC 	1000000
 #define NSEC_PER_SEC 	1000000000
@@ -128,6 +130,9 @@ int uniprocessor = 0;
 /* lock all memory */
 int lockall = 0;
 
+/* microseconds covered by the lock latency histograms, 0 = off */
+int histogram = 0;
+
 /* command line options */
 struct option options[] = {
 	{"duration", required_argument, NULL, 't'},
@@ -141,6 +146,7 @@ struct option options[] = {
 	{"debug", no_argument, NULL, 'd'},
 	{"version", no_argument, NULL, 'V'},
 	{"mlockall", no_argument, NULL, 'm'},
+	{"histogram", required_argument, NULL, 'H'},
 	{"help", no_argument, NULL, 'h'},
 	{NULL, 0, NULL, 0},
 };
@@ -205,6 +211,9 @@ struct group_parameters {
 	/* total watchdog hits */
 	int watchdog_hits;
 
+	/* time from the contended lock of the high thread to getting it */
+	struct rt_hist *hist;
+
 } *groups;
 
 /* number of consecutive watchdog hits before quitting */
@@ -235,6 +244,7 @@ int create_group(struct group_parameters *group);
 unsigned long total_inversions(void);
 void banner(void);
 void summary(void);
+void print_histograms(void);
 void wait_for_termination(void);
 int barrier_init(pthread_barrier_t * b, const pthread_barrierattr_t * attr,
 		 unsigned count, const char *name);
@@ -513,6 +523,15 @@ static inline void tsnorm(struct timespec *ts)
 	}
 }
 
+static inline unsigned long tsdelta_us(struct timespec *start,
+				       struct timespec *end)
+{
+	long long ns = (long long)(end->tv_sec - start->tv_sec) * NSEC_PER_SEC
+	    + end->tv_nsec - start->tv_nsec;
+
+	return ns > 0 ? NSEC_TO_USEC(ns) : 0;
+}
+
 /*
  * this routine serves two purposes:
  *   1. report progress
@@ -850,6 +869,7 @@ void *high_priority(void *arg)
 	int status;
 	int unbounded;
 	unsigned long count = 0;
+	struct timespec lock_start, lock_end;
 	struct group_parameters *p = (struct group_parameters *)arg;
 	pthread_barrier_t *loop_barr = &p->loop_barr;
 	pthread_mutex_t *loop_mtx = &p->loop_mtx;
@@ -922,11 +942,19 @@ void *high_priority(void *arg)
 			return NULL;
 		}
 		debug("high_priority[%d]: locking mutex\n", p->id);
+		/* the low thread holds the mutex and gets boosted */
+		if (histogram)
+			clock_gettime(CLOCK_MONOTONIC, &lock_start);
 		pthread_mutex_lock(&p->mutex);
+		if (histogram)
+			clock_gettime(CLOCK_MONOTONIC, &lock_end);
 		debug("high_priority[%d]: got mutex\n", p->id);
 
 		debug("high_priority[%d]: unlocking mutex\n", p->id);
 		pthread_mutex_unlock(&p->mutex);
+		if (histogram)
+			rt_hist_add(p->hist, histogram,
+				    tsdelta_us(&lock_start, &lock_end));
 		debug("high_priority[%d]: entering finish state\n", p->id);
 
 		status = pthread_barrier_wait(&p->finish_barrier);
@@ -1011,6 +1039,8 @@ void usage(void)
 	printf
 	    ("\t--uniprocessor\t- force all threads to run on one processor\n");
 	printf("\t--mlockall\t- lock current and future memory\n");
+	printf
+	    ("\t--histogram=<n>\t- lock latency histograms up to n usecs\n");
 	printf("\t--debug\t\t- turn on debug prints\n");
 	printf("\t--version\t- print version number on output\n");
 	printf("\t--help\t\t- print this message\n");
@@ -1080,6 +1110,14 @@ int initialize_group(struct group_parameters *group)
 
 	group->inversions = inversions;
 
+	if (histogram) {
+		group->hist = calloc(1, rt_hist_size(histogram));
+		if (group->hist == NULL) {
+			error("allocating histogram of group %d\n", group->id);
+			return FAILURE;
+		}
+	}
+
 	/* setup default attributes for the group mutex */
 	/* (make it a PI mutex) */
 	status = pthread_mutexattr_init(&mutex_attr);
@@ -1243,6 +1281,15 @@ void process_command_line(int argc, char **argv)
 		case 'm':
 			lockall = 1;
 			break;
+		case 'H':
+			histogram = strtol(optarg, NULL, 10);
+			if (histogram < 0) {
+				usage();
+				exit(1);
+			}
+			if (histogram > RT_HIST_MAX)
+				histogram = RT_HIST_MAX;
+			break;
 		}
 	}
 }
@@ -1290,6 +1337,28 @@ void summary(void)
 	printf("Total inversion performed: %lu\n", total_inversions());
 	printf("Test Duration: %d days, %d hours, %d minutes, %d seconds\n",
 	       t->tm_yday, t->tm_hour, t->tm_min, t->tm_sec);
+	if (histogram)
+		print_histograms();
+}
+
+/* the lock latency of every group, and of all groups in the last column */
+void print_histograms(void)
+{
+	struct rt_hist *hist[ngroups + 1];
+	int i;
+
+	hist[ngroups] = calloc(1, rt_hist_size(histogram));
+	if (hist[ngroups] == NULL) {
+		error("allocating histogram of all groups\n");
+		return;
+	}
+	for (i = 0; i < ngroups; i++) {
+		hist[i] = groups[i].hist;
+		rt_hist_merge(hist[ngroups], hist[i], histogram);
+	}
+	printf("PI lock latency of the high priority threads (usecs):\n");
+	rt_hist_print(hist, ngroups + 1, histogram);
+	free(hist[ngroups]);
 }
 
 int
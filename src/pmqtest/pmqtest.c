@@ -28,6 +28,8 @@
 #include <signal.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -37,6 +39,8 @@
 #include <mqueue.h>
 #include "rt-utils.h"
 #include "rt-get_cpu.h"
+#include "rt-shm.h"
+#include "rt-hist.h"
 #include "error.h"
 
 #include <pthread.h>
@@ -48,11 +52,14 @@
 #define SYNCMQ_NAME "/syncmsg%d"
 #define TESTMQ_NAME "/testmsg%d"
 #define MSG_SIZE 8
+#define MAX_MSG_SIZE 65536
+#define MAX_SIZES 16
+#define DEFAULT_DEPTH 10
+#define SHM_NAME "/pmqtest"
 #define MSEC_PER_SEC 1000
 #define NSEC_PER_SEC 1000000000
 
 char *syncmsg = "Syncing";
-char *testmsg = "Testing";
 
 enum {
 	AFFINITY_UNSPECIFIED,
@@ -69,23 +76,36 @@ struct params {
 	int samples;
 	int max_cycles;
 	int tracelimit;
+	int histogram;
 	int tid;
+	pid_t pid;
 	int shutdown;
 	int stopped;
 	struct timespec delay;
 	unsigned int mindiff, maxdiff;
 	double sumdiff;
-	struct timeval sent, received, diff;
+	long diff;
 	pthread_t threadid;
 	int timeout;
 	int forcetimeout;
 	int timeoutcount;
-	mqd_t syncmq, testmq;
+	mqd_t syncmq, testmq, trymq;
 	char recvsyncmsg[MSG_SIZE];
-	char recvtestmsg[MSG_SIZE];
-	struct params *neighbor;
+	int burst;
+	int msgsize;
+	int showsize;
+	uint64_t start;
+	int blocked;
+	unsigned int minblocked, maxblocked;
+	double sumblocked;
 	char error[MAX_PATH * 2];
-};
+} __attribute__((aligned(RT_SHM_CACHELINE)));
+
+static int mustfork;
+static int wasforked;
+static int wasforked_sender = -1;
+static int wasforked_threadno = -1;
+static struct rt_shm shm;
 
 void *pmqthread(void *param)
 {
@@ -95,6 +115,13 @@ void *pmqthread(void *param)
 	int policy = SCHED_FIFO;
 	struct sched_param schedp;
 	struct timespec ts;
+	struct rt_shm_stamp *stamp = rt_shm_slot(&shm, RT_SHM_STAMP, par->num);
+	struct rt_hist *hist = rt_shm_slot(&shm, RT_SHM_HIST, par->num);
+	struct params *neighbor = rt_shm_slot(&shm,
+	    par->sender ? RT_SHM_RECEIVER : RT_SHM_SENDER, par->num);
+	char *msg;
+	uint64_t seq = 0, first, last;
+	ssize_t len = 0;
 
 	memset(&schedp, 0, sizeof(schedp));
 	schedp.sched_priority = par->priority;
@@ -111,8 +138,25 @@ void *pmqthread(void *param)
 
 	par->tid = gettid();
 
+	/*
+	 * The message carries its sequence number in its first and in its
+	 * last eight bytes, the receiver checks both. The bytes in between
+	 * are a fixed pattern, they are only there to be copied.
+	 */
+	msg = malloc(par->msgsize);
+	if (msg == NULL) {
+		snprintf(par->error, sizeof(par->error),
+		    "could not allocate message buffer\n");
+		par->shutdown = 1;
+	} else
+		memset(msg, 0x5a, par->msgsize);
+
 	while (!par->shutdown) {
 		if (par->sender) {
+			memcpy(msg, &seq, sizeof(seq));
+			memcpy(msg + par->msgsize - sizeof(seq), &seq,
+			    sizeof(seq));
+			seq++;
 
 			/* Optionally force receiver timeout */
 			if (par->forcetimeout) {
@@ -124,8 +168,8 @@ void *pmqthread(void *param)
 			}
 
 			/* Send message: Start of latency measurement ... */
-			gettimeofday(&par->sent, NULL);
-			if (mq_send(par->testmq, testmsg, strlen(testmsg), 1) != 0) {
+			stamp->ns = rt_shm_gettime();
+			if (mq_send(par->testmq, msg, par->msgsize, 1) != 0) {
 				fprintf(stderr, "could not send test message\n");
 				par->shutdown = 1;
 			}
@@ -144,9 +188,8 @@ void *pmqthread(void *param)
 					fprintf(stderr, "could not receive sync message\n");
 					par->shutdown = 1;				
 				}
-			} 
-			if (mq_receive(par->syncmq, par->recvsyncmsg, MSG_SIZE, NULL) !=
-			    strlen(syncmsg)) {
+			} else if (mq_receive(par->syncmq, par->recvsyncmsg,
+			    MSG_SIZE, NULL) != strlen(syncmsg)) {
 				perror("could not receive sync message");
 				par->shutdown = 1;				
 			}
@@ -162,8 +205,9 @@ void *pmqthread(void *param)
 				par->timeoutcount = 0;
 				ts.tv_sec += par->timeout;
 				do {
-					if (mq_timedreceive(par->testmq, par->recvtestmsg,
-					    MSG_SIZE, NULL, &ts) != strlen(testmsg)) {
+					len = mq_timedreceive(par->testmq, msg,
+					    par->msgsize, NULL, &ts);
+					if (len != par->msgsize) {
 						if (!par->forcetimeout || errno != ETIMEDOUT) {
 							perror("could not receive test message");
 							par->shutdown = 1;
@@ -179,29 +223,41 @@ void *pmqthread(void *param)
 				}
 				while (1);
 			} else {
-				if (mq_receive(par->testmq, par->recvtestmsg, MSG_SIZE, NULL) !=
-				    strlen(testmsg)) {
+				len = mq_receive(par->testmq, msg, par->msgsize,
+				    NULL);
+				if (len != par->msgsize) {
 					perror("could not receive test message");
 					par->shutdown = 1;
 				}
 			}
+			/* A failed or short receive is no sample */
+			if (len != par->msgsize)
+				break;
+
 			/* ... Received the message: End of latency measurement */
-			gettimeofday(&par->received, NULL);
+			par->diff = (rt_shm_gettime() - stamp->ns) / 1000;
 
-			if (!par->shutdown && strcmp(testmsg, par->recvtestmsg)) {
+			memcpy(&first, msg, sizeof(first));
+			memcpy(&last, msg + par->msgsize - sizeof(last),
+			    sizeof(last));
+			if (!par->shutdown && (first != seq || last != seq)) {
 				fprintf(stderr, "ERROR: Test message mismatch detected\n");
-				fprintf(stderr, "  %s != %s\n", testmsg, par->recvtestmsg);
+				fprintf(stderr, "  sequence %llu/%llu != %llu\n",
+				    (unsigned long long) first,
+				    (unsigned long long) last,
+				    (unsigned long long) seq);
 				par->shutdown = 1;
 			}
+			seq++;
 			par->samples++;
-			timersub(&par->received, &par->neighbor->sent,
-			    &par->diff);
-
-			if (par->diff.tv_usec < par->mindiff)
-				par->mindiff = par->diff.tv_usec;
-			if (par->diff.tv_usec > par->maxdiff)
-				par->maxdiff = par->diff.tv_usec;
-			par->sumdiff += (double) par->diff.tv_usec;
+
+			if (par->diff < par->mindiff)
+				par->mindiff = par->diff;
+			if (par->diff > par->maxdiff)
+				par->maxdiff = par->diff;
+			par->sumdiff += (double) par->diff;
+			if (par->histogram)
+				rt_hist_add(hist, par->histogram, par->diff);
 			if (par->tracelimit && par->maxdiff > par->tracelimit) {
 				char tracing_enabled_file[MAX_PATH];
 
@@ -217,7 +273,7 @@ void *pmqthread(void *param)
 					    "Could not access %s\n",
 					    tracing_enabled_file);
 				par->shutdown = 1;
-				par->neighbor->shutdown = 1;
+				neighbor->shutdown = 1;
 			}
 
 			if (par->max_cycles && par->samples >= par->max_cycles)
@@ -233,6 +289,152 @@ void *pmqthread(void *param)
 			}
 		}
 	}
+	free(msg);
+	par->stopped = 1;
+	return NULL;
+}
+
+
+static inline uint64_t get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/*
+ * Streaming mode: the sender sends bursts of messages that carry their
+ * send time, without waiting for the receiver. When the queue is full,
+ * the sender blocks until the receiver has made room, the time it is
+ * blocked is the backpressure latency.
+ */
+void *pmqstreamthread(void *param)
+{
+	int mustgetcpu = 0;
+	struct params *par = param;
+	cpu_set_t mask;
+	int policy = SCHED_FIFO;
+	struct sched_param schedp;
+	char *msg;
+	uint64_t stamp, now;
+	unsigned int diff;
+	int i;
+	struct rt_hist *hist = rt_shm_slot(&shm, RT_SHM_HIST, par->num);
+	struct params *neighbor = rt_shm_slot(&shm,
+	    par->sender ? RT_SHM_RECEIVER : RT_SHM_SENDER, par->num);
+
+	memset(&schedp, 0, sizeof(schedp));
+	schedp.sched_priority = par->priority;
+	sched_setscheduler(0, policy, &schedp);
+
+	if (par->cpu != -1) {
+		CPU_ZERO(&mask);
+		CPU_SET(par->cpu, &mask);
+		if(sched_setaffinity(0, sizeof(mask), &mask) == -1)
+			fprintf(stderr,	"WARNING: Could not set CPU affinity "
+				"to CPU #%d\n", par->cpu);
+	} else
+		mustgetcpu = 1;
+
+	par->tid = gettid();
+
+	msg = calloc(1, par->msgsize);
+	if (msg == NULL) {
+		snprintf(par->error, sizeof(par->error),
+		    "could not allocate message buffer\n");
+		par->shutdown = 1;
+	}
+
+	while (!par->shutdown) {
+		if (par->sender) {
+			for (i = 0; i < par->burst && !par->shutdown; i++) {
+				/* Send message: Start of latency measurement ... */
+				stamp = get_time_us();
+				memcpy(msg, &stamp, sizeof(stamp));
+				if (mq_send(par->trymq, msg, par->msgsize, 1) == 0)
+					continue;
+				if (errno != EAGAIN) {
+					perror("could not send test message");
+					par->shutdown = 1;
+					break;
+				}
+
+				/* Queue full: wait for the receiver */
+				if (mq_send(par->testmq, msg, par->msgsize, 1) != 0) {
+					if (!par->shutdown)
+						perror("could not send test message");
+					par->shutdown = 1;
+					break;
+				}
+				diff = get_time_us() - stamp;
+				par->blocked++;
+				if (diff < par->minblocked)
+					par->minblocked = diff;
+				if (diff > par->maxblocked)
+					par->maxblocked = diff;
+				par->sumblocked += (double) diff;
+			}
+			par->samples++;
+			if(par->max_cycles && par->samples >= par->max_cycles)
+				par->shutdown = 1;
+			if (mustgetcpu)
+				par->cpu = get_cpu();
+			if (par->delay.tv_sec || par->delay.tv_nsec)
+				clock_nanosleep(CLOCK_MONOTONIC, 0, &par->delay,
+				    NULL);
+		} else {
+			/* Receiver */
+			if (mq_receive(par->testmq, msg, par->msgsize, NULL) !=
+			    par->msgsize) {
+				if (!par->shutdown)
+					perror("could not receive test message");
+				par->shutdown = 1;
+				break;
+			}
+			/* ... Received the message: End of latency measurement */
+			now = get_time_us();
+			memcpy(&stamp, msg, sizeof(stamp));
+
+			if (par->start == 0)
+				par->start = now;
+			par->samples++;
+			diff = now - stamp;
+			par->diff = diff;
+
+			if (diff < par->mindiff)
+				par->mindiff = diff;
+			if (diff > par->maxdiff)
+				par->maxdiff = diff;
+			par->sumdiff += (double) diff;
+			if (par->histogram)
+				rt_hist_add(hist, par->histogram, diff);
+			if (par->tracelimit && par->maxdiff > par->tracelimit) {
+				char tracing_enabled_file[MAX_PATH];
+
+				strcpy(tracing_enabled_file, get_debugfileprefix());
+				strcat(tracing_enabled_file, "tracing_enabled");
+				int tracing_enabled =
+				    open(tracing_enabled_file, O_WRONLY);
+				if (tracing_enabled >= 0) {
+					write(tracing_enabled, "0", 1);
+					close(tracing_enabled);
+				} else
+					snprintf(par->error, sizeof(par->error),
+					    "Could not access %s\n",
+					    tracing_enabled_file);
+				par->shutdown = 1;
+				neighbor->shutdown = 1;
+			}
+
+			if (par->max_cycles &&
+			    par->samples >= par->max_cycles * par->burst)
+				par->shutdown = 1;
+			if (mustgetcpu)
+				par->cpu = get_cpu();
+		}
+	}
+	free(msg);
 	par->stopped = 1;
 	return NULL;
 }
@@ -243,16 +445,31 @@ static void display_help(void)
 	printf("pmqtest V %1.2f\n", VERSION_STRING);
 	puts("Usage: pmqtest <options>");
 	puts("Function: test POSIX message queue latency");
-	puts(
+	printf(
 	"Options:\n"
 	"-a [NUM] --affinity        run thread #N on processor #N, if possible\n"
 	"                           with NUM pin all threads to the processor NUM\n"
 	"-b USEC  --breaktrace=USEC send break trace command when latency > USEC\n"
+	"-B NUM   --burst=NUM       streaming mode: send bursts of NUM messages\n"
+	"                           without waiting for the receiver\n"
 	"-d DIST  --distance=DIST   distance of thread intervals in us default=500\n"
+	"-D       --duration=t      specify a length for the test run\n"
+	"                           default is in seconds, but 'm', 'h', or 'd' maybe added\n"
+	"                           to modify value to minutes, hours or days\n"
 	"-f TO    --forcetimeout=TO force timeout of mq_timedreceive(), requires -T\n"
+	"-F       --fork            fork new processes instead of creating threads\n"
+	"-h       --histogram=US    dump a latency histogram to stdout after the run\n"
+	"                           US is the max time to be tracked in microseconds\n"
 	"-i INTV  --interval=INTV   base interval of thread in us default=1000\n"
+	"                           with -B, 0 sends bursts without pause\n"
 	"-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
+	"-m LIST  --msgsize=LIST    comma separated list of message sizes in bytes,\n"
+	"                           8 to %d, every size gets its own thread\n"
+	"                           pairs, default=%d\n"
 	"-p PRIO  --prio=PRIO       priority\n"
+	"-q       --quiet           print only a summary on exit\n"
+	"-Q NUM   --depth=NUM       queue depth in messages, default=1,\n"
+	"                           with -B default=%d\n"
 	"-S       --smp             SMP testing: options -a -t and same priority\n"
         "                           of all threads\n"
 	"-t       --threads         one thread per available processor\n"
@@ -260,7 +477,8 @@ static void display_help(void)
 	"                           without NUM, threads = max_cpus\n"
 	"                           without -t default = 1\n"
 	"-T TO    --timeout=TO      use mq_timedreceive() instead of mq_receive()\n"
-	"                           with timeout TO in seconds\n");
+	"                           with timeout TO in seconds\n",
+	MAX_MSG_SIZE, MSG_SIZE, DEFAULT_DEPTH);
 	exit(1);
 }
 
@@ -273,10 +491,57 @@ static int num_threads = 1;
 static int max_cycles;
 static int interval = 1000;
 static int distance = 500;
+static int histogram;
+static int quiet;
+static int duration;
 static int smp;
 static int sameprio;
 static int timeout;
 static int forcetimeout;
+static int burst;
+static int depth;
+static int msgsizes[MAX_SIZES] = { MSG_SIZE };
+static int num_sizes;
+
+static int parse_sizes(char *list)
+{
+	char *size, *end, *saveptr = NULL;
+
+	num_sizes = 0;
+	for (size = strtok_r(list, ",", &saveptr); size != NULL;
+	     size = strtok_r(NULL, ",", &saveptr)) {
+		if (num_sizes == MAX_SIZES) {
+			fprintf(stderr, "ERROR: too many message sizes\n");
+			return -1;
+		}
+		msgsizes[num_sizes] = strtol(size, &end, 10);
+		if (*end != '\0' || msgsizes[num_sizes] < MSG_SIZE ||
+		    msgsizes[num_sizes] > MAX_MSG_SIZE) {
+			fprintf(stderr, "ERROR: invalid message size %s\n",
+			    size);
+			return -1;
+		}
+		num_sizes++;
+	}
+	return num_sizes ? 0 : -1;
+}
+
+/* Return a limit from /proc/sys/fs/mqueue, or -1 if it is not readable */
+static int get_mq_limit(char *name)
+{
+	char path[MAX_PATH];
+	FILE *f;
+	int val;
+
+	snprintf(path, sizeof(path), "/proc/sys/fs/mqueue/%s", name);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	if (fscanf(f, "%d", &val) != 1)
+		val = -1;
+	fclose(f);
+	return val;
+}
 
 static void process_options (int argc, char *argv[])
 {
@@ -289,18 +554,25 @@ static void process_options (int argc, char *argv[])
 		static struct option long_options[] = {
 			{"affinity", optional_argument, NULL, 'a'},
 			{"breaktrace", required_argument, NULL, 'b'},
+			{"burst", required_argument, NULL, 'B'},
 			{"distance", required_argument, NULL, 'd'},
+			{"duration", required_argument, NULL, 'D'},
+			{"depth", required_argument, NULL, 'Q'},
 			{"forcetimeout", required_argument, NULL, 'f'},
+			{"fork", optional_argument, NULL, 'F'},
+			{"histogram", required_argument, NULL, 'h'},
 			{"interval", required_argument, NULL, 'i'},
 			{"loops", required_argument, NULL, 'l'},
+			{"msgsize", required_argument, NULL, 'm'},
 			{"priority", required_argument, NULL, 'p'},
+			{"quiet", no_argument, NULL, 'q'},
 			{"smp", no_argument, NULL, 'S'},
 			{"threads", optional_argument, NULL, 't'},
 			{"timeout", required_argument, NULL, 'T'},
 			{"help", no_argument, NULL, '?'},
 			{NULL, 0, NULL, 0}
 		};
-		int c = getopt_long (argc, argv, "a::b:d:f:i:l:p:St::T:",
+		int c = getopt_long (argc, argv, "a::b:B:d:D:f:F::h:i:l:m:p:qQ:St::T:",
 			long_options, &option_index);
 		if (c == -1)
 			break;
@@ -321,11 +593,35 @@ static void process_options (int argc, char *argv[])
 			}
 			break;
 		case 'b': tracelimit = atoi(optarg); break;
+		case 'B': burst = atoi(optarg); break;
 		case 'd': distance = atoi(optarg); break;
+		case 'D': duration = parse_time_string(optarg); break;
 		case 'f': forcetimeout = atoi(optarg); break;
+		case 'F':
+			if (optarg != NULL) {
+				wasforked = 1;
+				if (optarg[0] == 's')
+					wasforked_sender = 1;
+				else if (optarg[0] == 'r')
+					wasforked_sender = 0;
+				wasforked_threadno = atoi(optarg+1);
+			} else
+				mustfork = 1;
+			break;
+		case 'h': histogram = atoi(optarg); break;
 		case 'i': interval = atoi(optarg); break;
 		case 'l': max_cycles = atoi(optarg); break;
+		case 'm':
+			if (parse_sizes(optarg))
+				error = 1;
+			break;
 		case 'p': priority = atoi(optarg); break;
+		case 'q': quiet = 1; break;
+		case 'Q':
+			depth = atoi(optarg);
+			if (depth < 1)
+				error = 1;
+			break;
 		case 'S':
 			smp = 1;
 			num_threads = max_cpus;
@@ -364,12 +660,28 @@ static void process_options (int argc, char *argv[])
 	if (priority < 0 || priority > 99)
 		error = 1;
 
+	if (histogram < 0)
+		error = 1;
+
+	if (histogram > RT_HIST_MAX)
+		histogram = RT_HIST_MAX;
+
+	if (duration < 0)
+		error = 1;
+
 	if (num_threads < 1)
 		error = 1;
 
 	if (forcetimeout && !timeout)
 		error = 1;
- 
+
+	if (burst < 0 || (burst && timeout) || interval < 0)
+		error = 1;
+
+	/* Ping-pong has at most one message in the queue */
+	if (!depth)
+		depth = burst ? DEFAULT_DEPTH : 1;
+
 	if (priority && smp)
 		sameprio = 1;
 
@@ -385,9 +697,50 @@ static void sighand(int sig)
 	shutdown = 1;
 }
 
+/* Throughput and backpressure latency of a streaming pair */
+static void print_stream(struct params *receiver, struct params *sender)
+{
+	uint64_t now = get_time_us();
+	double rate = 0.0;
+
+	if (receiver->start && now > receiver->start)
+		rate = receiver->samples * (double) USEC_PER_SEC /
+		    (now - receiver->start);
+	printf("#%d -> #%d, %.0f msgs/s, Blocked %d",
+	    sender->num*2+1, receiver->num*2, rate, sender->blocked);
+	if (sender->blocked)
+		printf(", Min %4d, Avg %4d, Max %4d",
+		    sender->minblocked,
+		    (int) ((sender->sumblocked / sender->blocked) + 0.5),
+		    sender->maxblocked);
+	printf("   \n");
+}
+
+/* Open the queues of a pair that were created by the parent */
+static int open_queues(struct params *par)
+{
+	char mqname[16];
+
+	sprintf(mqname, SYNCMQ_NAME, par->num);
+	par->syncmq = mq_open(mqname, O_RDWR);
+	if (par->syncmq == (mqd_t) -1)
+		return -1;
+	sprintf(mqname, TESTMQ_NAME, par->num);
+	par->testmq = mq_open(mqname, O_RDWR);
+	if (par->testmq == (mqd_t) -1)
+		return -1;
+	if (par->burst) {
+		par->trymq = mq_open(mqname, O_WRONLY|O_NONBLOCK);
+		if (par->trymq == (mqd_t) -1)
+			return -1;
+	}
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
-	int i;
+	int i, num_pairs;
+	int startprio, startinterval;
 	int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
 	struct params *receiver = NULL;
 	struct params *sender = NULL;
@@ -396,9 +749,12 @@ int main(int argc, char *argv[])
 	int oldtimeoutcount = INT_MAX;
 	int first = 1;
 	int errorlines = 0;
-	struct timespec maindelay;
+	struct timespec launchdelay, maindelay;
+	uint64_t stoptime;
+	char f_opt[16];
 	int oflag = O_CREAT|O_RDWR;
-	struct mq_attr mqstat;
+	struct mq_attr mqstat, teststat;
+	int lines;
 
 	memset(&mqstat, 0, sizeof(mqstat));
 	mqstat.mq_maxmsg = 1;
@@ -407,6 +763,13 @@ int main(int argc, char *argv[])
 
 	process_options(argc, argv);
 
+	memset(&teststat, 0, sizeof(teststat));
+	teststat.mq_maxmsg = depth;
+	teststat.mq_flags = 0;
+
+	/* Streaming mode prints the backpressure latency in an extra line */
+	lines = burst ? 3 : 2;
+
 	if (check_privs())
 		return 1;
 
@@ -415,6 +778,43 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (wasforked) {
+		struct params *par;
+
+		if (wasforked_threadno == -1 || wasforked_sender == -1) {
+			fprintf(stderr, "Invalid fork option\n");
+			return 1;
+		}
+		if (rt_shm_attach(&shm, SHM_NAME, sizeof(struct params), 0)) {
+			fprintf(stderr, "Could not attach shared memory: %s\n",
+			    errno == EPROTO ? "layout mismatch" :
+			    strerror(errno));
+			return 1;
+		}
+		if (wasforked_threadno >= rt_shm_num_pairs(&shm)) {
+			fprintf(stderr, "Invalid fork option\n");
+			rt_shm_detach(&shm);
+			return 1;
+		}
+		par = rt_shm_slot(&shm, wasforked_sender ? RT_SHM_SENDER :
+		    RT_SHM_RECEIVER, wasforked_threadno);
+
+		/* Message queue descriptors are per process */
+		if (open_queues(par)) {
+			perror("could not open POSIX message queues");
+			rt_shm_detach(&shm);
+			return 1;
+		}
+		sigemptyset(&sigset);
+		pthread_sigmask(SIG_SETMASK, &sigset, NULL);
+		if (par->burst)
+			pmqstreamthread(par);
+		else
+			pmqthread(par);
+		rt_shm_detach(&shm);
+		return 0;
+	}
+
 	sigemptyset(&sigset);
 	sigaddset(&sigset, SIGTERM);
 	sigaddset(&sigset, SIGINT);
@@ -423,12 +823,35 @@ int main(int argc, char *argv[])
 	signal(SIGINT, sighand);
 	signal(SIGTERM, sighand);
 
-	receiver = calloc(num_threads, sizeof(struct params));
-	sender = calloc(num_threads, sizeof(struct params));
-	if (receiver == NULL || sender == NULL)
-		goto nomem;
-
-	for (i = 0; i < num_threads; i++) {
+	/* Every message size runs num_threads pairs of its own */
+	num_pairs = num_threads * (num_sizes ? num_sizes : 1);
+	startprio = priority;
+	startinterval = interval;
+
+	/*
+	 * The params of all threads are in shared memory, see rt-shm.h.
+	 * In fork mode (-F), it is a named region that the children
+	 * attach to.
+	 */
+	if (rt_shm_create(&shm, mustfork ? SHM_NAME : NULL, num_pairs,
+	    sizeof(struct params), histogram ? rt_hist_size(histogram) : 0,
+	    0)) {
+		fprintf(stderr, "Could not create shared memory: %s\n",
+		    strerror(errno));
+		return 1;
+	}
+	receiver = rt_shm_slot(&shm, RT_SHM_RECEIVER, 0);
+	sender = rt_shm_slot(&shm, RT_SHM_SENDER, 0);
+
+	launchdelay.tv_sec = 0;
+	launchdelay.tv_nsec = 10000000; /* 10 ms */
+
+	/*
+	 * Open all queues before the first pair starts, so that a depth or
+	 * size beyond the limits of /proc/sys/fs/mqueue fails before
+	 * anything runs.
+	 */
+	for (i = 0; i < num_pairs; i++) {
 		char mqname[16];
 
 		sprintf(mqname, SYNCMQ_NAME, i);
@@ -437,16 +860,46 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "could not open POSIX message queue #1\n");
 			return 1;
 		}
+		receiver[i].msgsize = msgsizes[i / num_threads];
 		sprintf(mqname, TESTMQ_NAME, i);
-		receiver[i].testmq = mq_open(mqname, oflag, 0777, &mqstat);
+		/* A left over queue would keep its old attributes */
+		mq_unlink(mqname);
+		teststat.mq_msgsize = receiver[i].msgsize;
+		receiver[i].testmq = mq_open(mqname, oflag, 0777, &teststat);
 		if (receiver[i].testmq == (mqd_t) -1) {
-			fprintf(stderr, "could not open POSIX message queue #2\n");
+			fprintf(stderr, "could not open POSIX message queue #2: "
+			    "%s\n", strerror(errno));
+			if (errno == EINVAL)
+				fprintf(stderr, "depth %d and size %d exceed "
+				    "/proc/sys/fs/mqueue/msg_max (%d) or "
+				    "msgsize_max (%d)?\n", depth,
+				    receiver[i].msgsize, get_mq_limit("msg_max"),
+				    get_mq_limit("msgsize_max"));
 			return 1;
 		}
+		if (burst) {
+			receiver[i].trymq = mq_open(mqname, O_WRONLY|O_NONBLOCK);
+			if (receiver[i].trymq == (mqd_t) -1) {
+				fprintf(stderr, "could not open POSIX message "
+				    "queue #3: %s\n", strerror(errno));
+				return 1;
+			}
+		}
+	}
 
+	for (i = 0; i < num_pairs; i++) {
 		receiver[i].mindiff = UINT_MAX;
 		receiver[i].maxdiff = 0;
 		receiver[i].sumdiff = 0.0;
+		receiver[i].minblocked = UINT_MAX;
+		receiver[i].burst = burst;
+		receiver[i].showsize = num_sizes > 0;
+
+		/* Every message size starts with the same priority and interval */
+		if (i % num_threads == 0) {
+			priority = startprio;
+			interval = startinterval;
+		}
 
 		receiver[i].num = i;
 		receiver[i].cpu = i;
@@ -463,54 +916,115 @@ int main(int argc, char *argv[])
 		receiver[i].delay.tv_nsec = (interval % USEC_PER_SEC) * 1000;
 		interval += distance;
 		receiver[i].max_cycles = max_cycles;
+		receiver[i].histogram = histogram;
 		receiver[i].sender = 0;
-		receiver[i].neighbor = &sender[i];
 		receiver[i].timeout = timeout;
 		receiver[i].forcetimeout = forcetimeout;
-		pthread_create(&receiver[i].threadid, NULL, pmqthread, &receiver[i]);
+		if (mustfork) {
+			pid_t pid = fork();
+			if (pid == -1) {
+				fprintf(stderr, "Could not fork\n");
+				return 1;
+			} else if (pid == 0) {
+				char *args[3];
+
+				receiver[i].pid = getpid();
+				sprintf(f_opt, "-Fr%d", i);
+				args[0] = argv[0];
+				args[1] = f_opt;
+				args[2] = NULL;
+				execvp(args[0], args);
+				fprintf(stderr,
+				    "Could not execute receiver child process "
+				    "#%d\n", i);
+			}
+			nanosleep(&launchdelay, NULL);
+		} else
+			pthread_create(&receiver[i].threadid, NULL,
+			    burst ? pmqstreamthread : pmqthread, &receiver[i]);
 		memcpy(&sender[i], &receiver[i], sizeof(receiver[0]));
 		sender[i].sender = 1;
-		sender[i].neighbor = &receiver[i];
-		pthread_create(&sender[i].threadid, NULL, pmqthread, &sender[i]);
+		if (mustfork) {
+			pid_t pid = fork();
+			if (pid == -1) {
+				fprintf(stderr, "Could not fork\n");
+				return 1;
+			} else if (pid == 0) {
+				char *args[3];
+
+				sender[i].pid = getpid();
+				sprintf(f_opt, "-Fs%d", i);
+				args[0] = argv[0];
+				args[1] = f_opt;
+				args[2] = NULL;
+				execvp(args[0], args);
+				fprintf(stderr,
+				    "Could not execute sender child process "
+				    "#%d\n", i);
+			}
+		} else
+			pthread_create(&sender[i].threadid, NULL,
+			    burst ? pmqstreamthread : pmqthread, &sender[i]);
 	}
 
-	maindelay.tv_sec = 0;
-	maindelay.tv_nsec = 50000000; /* 50 ms */
+	rt_shm_maindelay(&maindelay, quiet);
 
 	sigemptyset(&sigset);
 	pthread_sigmask(SIG_SETMASK, &sigset, NULL);
 
+	stoptime = rt_shm_gettime() + duration * 1000000000ULL;
 	do {
 		int newsamples = 0, newtimeoutcount = 0;
 		int minsamples = INT_MAX;
 
-		for (i = 0; i < num_threads; i++) {
+		/* Checked before printing, so that the final result is shown */
+		for (i = 0; i < num_pairs; i++)
+			shutdown |= receiver[i].shutdown | sender[i].shutdown;
+		if (duration && rt_shm_gettime() >= stoptime)
+			shutdown = 1;
+
+		for (i = 0; i < num_pairs; i++) {
 			newsamples += receiver[i].samples;
 			newtimeoutcount += receiver[i].timeoutcount;
 			if (receiver[i].samples < minsamples)
 				minsamples = receiver[i].samples;
 		}
 
-		if (minsamples > 1 && (shutdown || newsamples > oldsamples ||
-			newtimeoutcount > oldtimeoutcount)) {
+		/*
+		 * The summary is printed at shutdown in any case, also when
+		 * a pair stopped early, as its error tells why.
+		 */
+		if (shutdown || (minsamples > 1 && !quiet &&
+		    (newsamples > oldsamples ||
+		    newtimeoutcount > oldtimeoutcount))) {
 
 			if (!first)
-				printf("\033[%dA", num_threads*2 + errorlines);
+				printf("\033[%dA", num_pairs*lines + errorlines);
 			first = 0;
 
-			for (i = 0; i < num_threads; i++) {
+			for (i = 0; i < num_pairs; i++) {
 				printf("#%1d: ID%d, P%d, CPU%d, I%ld; #%1d: ID%d, P%d, CPU%d, TO %d, Cycles %d   \n",
-				    i*2, receiver[i].tid, receiver[i].priority, receiver[i].cpu,
+				    i*2, mustfork ? receiver[i].pid : receiver[i].tid,
+				    receiver[i].priority, receiver[i].cpu,
 				    receiver[i].delay.tv_nsec / 1000,
-				    i*2+1, sender[i].tid, sender[i].priority, sender[i].cpu,
+				    i*2+1, mustfork ? sender[i].pid : sender[i].tid,
+				    sender[i].priority, sender[i].cpu,
 				    receiver[i].timeoutcount, sender[i].samples);
 			}
-			for (i = 0; i < num_threads; i++) {
-				printf("#%d -> #%d, Min %4d, Cur %4d, Avg %4d, Max %4d\n",
-					i*2+1, i*2,
-					receiver[i].mindiff, (int) receiver[i].diff.tv_usec,
-					(int) ((receiver[i].sumdiff / receiver[i].samples) + 0.5),
+			for (i = 0; i < num_pairs; i++) {
+				if (receiver[i].showsize)
+					printf("#%d -> #%d, %5d B, ", i*2+1, i*2,
+					    receiver[i].msgsize);
+				else
+					printf("#%d -> #%d, ", i*2+1, i*2);
+				printf("Min %4d, Cur %4d, Avg %4d, Max %4d\n",
+					receiver[i].samples ? receiver[i].mindiff : 0,
+					(int) receiver[i].diff,
+					receiver[i].samples ? (int) ((receiver[i].sumdiff /
+					receiver[i].samples) + 0.5) : 0,
 					receiver[i].maxdiff);
+				if (burst)
+					print_stream(&receiver[i], &sender[i]);
 				if (receiver[i].error[0] != '\0') {
 					printf(receiver[i].error);
 					errorlines++;
@@ -523,7 +1037,7 @@ int main(int argc, char *argv[])
 				}
 			}
 		} else {
-			if (minsamples < 1)
+			if (minsamples < 1 && !quiet)
 				printf("Collecting ...\n\033[1A");
 		}
 		
@@ -531,43 +1045,63 @@ int main(int argc, char *argv[])
 
 		oldsamples = 0;
 		oldtimeoutcount = 0;
-		for (i = 0; i < num_threads; i++) {
+		for (i = 0; i < num_pairs; i++) {
 			oldsamples += receiver[i].samples;
 			oldtimeoutcount += receiver[i].timeoutcount;
 		}
 
 		nanosleep(&maindelay, NULL);
 
-		for (i = 0; i < num_threads; i++)
-			shutdown |= receiver[i].shutdown | sender[i].shutdown;
-
 	} while (!shutdown);
 
-	for (i = 0; i < num_threads; i++) {
+	for (i = 0; i < num_pairs; i++) {
 		receiver[i].shutdown = 1;
 		sender[i].shutdown = 1;
 	}
 
-	for (i = 0; i < num_threads; i++) {
-		if (!receiver[i].stopped)
-			pthread_kill(receiver[i].threadid, SIGTERM);
-		if (!sender[i].stopped)
-			pthread_kill(sender[i].threadid, SIGTERM);
+	for (i = 0; i < num_pairs; i++) {
+		if (!receiver[i].stopped) {
+			if (mustfork)
+				kill(receiver[i].pid, SIGTERM);
+			else
+				pthread_kill(receiver[i].threadid, SIGTERM);
+		}
+		if (!sender[i].stopped) {
+			if (mustfork)
+				kill(sender[i].pid, SIGTERM);
+			else
+				pthread_kill(sender[i].threadid, SIGTERM);
+		}
 	}
 	nanosleep(&maindelay, NULL);
-	for (i = 0; i < num_threads; i++) {
+	for (i = 0; i < num_pairs; i++) {
 		char mqname[16];
 
-		mq_close(receiver[i].syncmq);
+		/*
+		 * In fork mode, the children have stored their own
+		 * descriptors in the shared params, ours are closed on exit.
+		 */
+		if (!mustfork) {
+			mq_close(receiver[i].syncmq);
+			mq_close(receiver[i].testmq);
+			if (burst)
+				mq_close(receiver[i].trymq);
+		}
 		sprintf(mqname, SYNCMQ_NAME, i);
 		mq_unlink(mqname);
-
-		mq_close(receiver[i].testmq);
 		sprintf(mqname, TESTMQ_NAME, i);
 		mq_unlink(mqname);
 	}
 
-	nomem:
+	if (histogram) {
+		struct rt_hist *hist[num_pairs];
+
+		for (i = 0; i < num_pairs; i++)
+			hist[i] = rt_shm_slot(&shm, RT_SHM_HIST, i);
+		rt_hist_print(hist, num_pairs, histogram);
+	}
+
+	rt_shm_destroy(&shm);
 
 	return 0;
 }
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <limits.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <signal.h>
@@ -34,8 +35,11 @@
 #include <sys/mman.h>
 #include <linux/unistd.h>
 #include <utmpx.h>
+#include <semaphore.h>
 #include "rt-utils.h"
 #include "rt-get_cpu.h"
+#include "rt-shm.h"
+#include "rt-hist.h"
 #include "error.h"
 
 #include <pthread.h>
@@ -44,14 +48,40 @@
 
 #define USEC_PER_SEC 1000000
 
+#define SHM_NAME "/ptsematest"
+
 enum {
 	AFFINITY_UNSPECIFIED,
 	AFFINITY_SPECIFIED,
 	AFFINITY_USEALL
 };
 
-static pthread_mutex_t *testmutex;
-static pthread_mutex_t *syncmutex;
+enum {
+	PROTO_NONE,
+	PROTO_INHERIT,
+	PROTO_PROTECT,
+	NUM_PROTOCOLS
+};
+
+static char *protocol_names[NUM_PROTOCOLS] = { "none", "inherit", "protect" };
+static int protocol_attr[NUM_PROTOCOLS] = {
+	PTHREAD_PRIO_NONE, PTHREAD_PRIO_INHERIT, PTHREAD_PRIO_PROTECT
+};
+
+/* Contenders hold the mutex for CONTENDER_HOLD us every CONTENDER_PAUSE us */
+#define CONTENDER_HOLD 10
+#define CONTENDER_PAUSE 100
+
+/*
+ * The mutexes of a pair, process-shared in fork mode (-f). The semaphores
+ * pace the handoff of testmutex if a protocol is selected (-m).
+ */
+struct mutexes {
+	pthread_mutex_t testmutex;
+	pthread_mutex_t syncmutex;
+	sem_t ready;
+	sem_t done;
+};
 
 struct params {
 	int num;
@@ -62,23 +92,39 @@ struct params {
 	int samples;
 	int max_cycles;
 	int tracelimit;
+	int histogram;
+	int protocol;	/* -1 without -m */
 	int tid;
+	pid_t pid;
 	int shutdown;
 	int stopped;
 	struct timespec delay;
 	unsigned int mindiff, maxdiff;
 	double sumdiff;
-	struct timeval unblocked, received, diff;
+	long diff;
 	pthread_t threadid;
-	struct params *neighbor;
 	char error[MAX_PATH * 2];
+} __attribute__((aligned(RT_SHM_CACHELINE)));
+
+static int mustfork;
+static int wasforked;
+static int wasforked_sender = -1;
+static int wasforked_threadno = -1;
+static struct rt_shm shm;
+
+/* Lower priority threads that take the test mutex of a pair (-c) */
+struct contender {
+	int num;
+	int cpu;	/* the sender's, -1 if it is not pinned */
+	int priority;
+	volatile int shutdown;
+	volatile int stopped;
+	pthread_t threadid;
 };
 
-void *semathread(void *param)
+static int setup_thread(struct params *par)
 {
 	int mustgetcpu = 0;
-	int first = 1;
-	struct params *par = param;
 	cpu_set_t mask;
 	int policy = SCHED_FIFO;
 	struct sched_param schedp;
@@ -97,14 +143,63 @@ void *semathread(void *param)
 		mustgetcpu = 1;
 
 	par->tid = gettid();
+	return mustgetcpu;
+}
+
+static void update_latency(struct params *par, struct params *neighbor,
+			   struct rt_hist *hist)
+{
+	par->samples++;
+
+	if (par->diff < par->mindiff)
+		par->mindiff = par->diff;
+	if (par->diff > par->maxdiff)
+		par->maxdiff = par->diff;
+	par->sumdiff += (double) par->diff;
+	if (par->histogram)
+		rt_hist_add(hist, par->histogram, par->diff);
+	if (par->tracelimit && par->maxdiff > par->tracelimit) {
+		char tracing_enabled_file[MAX_PATH];
+
+		strcpy(tracing_enabled_file, get_debugfileprefix());
+		strcat(tracing_enabled_file, "tracing_enabled");
+		int tracing_enabled =
+		    open(tracing_enabled_file, O_WRONLY);
+		if (tracing_enabled >= 0) {
+			write(tracing_enabled, "0", 1);
+			close(tracing_enabled);
+		} else
+			snprintf(par->error, sizeof(par->error),
+			    "Could not access %s\n",
+			    tracing_enabled_file);
+		par->shutdown = 1;
+		neighbor->shutdown = 1;
+	}
+
+	if (par->max_cycles && par->samples >= par->max_cycles)
+		par->shutdown = 1;
+}
+
+void *semathread(void *param)
+{
+	int mustgetcpu;
+	int first = 1;
+	struct params *par = param;
+	struct rt_shm_stamp *stamp = rt_shm_slot(&shm, RT_SHM_STAMP, par->num);
+	struct rt_hist *hist = rt_shm_slot(&shm, RT_SHM_HIST, par->num);
+	struct mutexes *m = rt_shm_slot(&shm, RT_SHM_SYNC, par->num);
+	struct params *neighbor = rt_shm_slot(&shm,
+	    par->sender ? RT_SHM_RECEIVER : RT_SHM_SENDER, par->num);
+
+	mustgetcpu = setup_thread(par);
 
 	while (!par->shutdown) {
 		if (par->sender) {
-			pthread_mutex_lock(&syncmutex[par->num]);
+			pthread_mutex_lock(&m->syncmutex);
 
 			/* Release lock: Start of latency measurement ... */
-			gettimeofday(&par->unblocked, NULL);
-			pthread_mutex_unlock(&testmutex[par->num]);
+			stamp->ns = rt_shm_gettime();
+			pthread_mutex_unlock(&m->testmutex);
 			par->samples++;
 			if(par->max_cycles && par->samples >= par->max_cycles)
 				par->shutdown = 1;
@@ -113,52 +208,138 @@ void *semathread(void *param)
 		} else {
 			/* Receiver */
 			if (!first) {
-				pthread_mutex_lock(&syncmutex[par->num]);
+				pthread_mutex_lock(&m->syncmutex);
 				first = 1;
 			}
-			pthread_mutex_lock(&testmutex[par->num]);
+			pthread_mutex_lock(&m->testmutex);
 
 			/* ... Got the lock: End of latency measurement */
-			gettimeofday(&par->received, NULL);
-			par->samples++;
-			timersub(&par->received, &par->neighbor->unblocked,
-			    &par->diff);
-
-			if (par->diff.tv_usec < par->mindiff)
-				par->mindiff = par->diff.tv_usec;
-			if (par->diff.tv_usec > par->maxdiff)
-				par->maxdiff = par->diff.tv_usec;
-			par->sumdiff += (double) par->diff.tv_usec;
-			if (par->tracelimit && par->maxdiff > par->tracelimit) {
-				char tracing_enabled_file[MAX_PATH];
-
-				strcpy(tracing_enabled_file, get_debugfileprefix());
-				strcat(tracing_enabled_file, "tracing_enabled");
-				int tracing_enabled =
-				    open(tracing_enabled_file, O_WRONLY);
-				if (tracing_enabled >= 0) {
-					write(tracing_enabled, "0", 1);
-					close(tracing_enabled);
-				} else
-					snprintf(par->error, sizeof(par->error),
-					    "Could not access %s\n",
-					    tracing_enabled_file);
+			par->diff = (rt_shm_gettime() - stamp->ns) / 1000;
+			update_latency(par, neighbor, hist);
+			if (mustgetcpu)
+				par->cpu = get_cpu();
+			nanosleep(&par->delay, NULL);
+			pthread_mutex_unlock(&m->syncmutex);
+		}
+	}
+	par->stopped = 1;
+	return NULL;
+}
+
+/*
+ * Handoff of a mutex with a protocol (-m). Unlike semathread(), every
+ * thread only unlocks what it has locked, as PI and priority ceiling
+ * mutexes require. The sender takes the test mutex, lets the receiver
+ * block on it and measures from its unlock to the receiver's acquisition,
+ * while the contenders of the pair may compete for the mutex as well.
+ */
+void *mutexthread(void *param)
+{
+	int mustgetcpu;
+	struct params *par = param;
+	struct rt_shm_stamp *stamp = rt_shm_slot(&shm, RT_SHM_STAMP, par->num);
+	struct rt_hist *hist = rt_shm_slot(&shm, RT_SHM_HIST, par->num);
+	struct mutexes *m = rt_shm_slot(&shm, RT_SHM_SYNC, par->num);
+	struct params *neighbor = rt_shm_slot(&shm,
+	    par->sender ? RT_SHM_RECEIVER : RT_SHM_SENDER, par->num);
+	int ret;
+
+	mustgetcpu = setup_thread(par);
+
+	while (!par->shutdown) {
+		if (par->sender) {
+			ret = pthread_mutex_lock(&m->testmutex);
+			if (ret) {
+				snprintf(par->error, sizeof(par->error),
+				    "Could not lock %s mutex: %s\n",
+				    protocol_names[par->protocol],
+				    strerror(ret));
 				par->shutdown = 1;
-				par->neighbor->shutdown = 1;
+				neighbor->shutdown = 1;
+				break;
 			}
+			sem_post(&m->ready);
+
+			/* Let the receiver block on the mutex */
+			nanosleep(&par->delay, NULL);
 
+			/* Release lock: Start of latency measurement ... */
+			stamp->ns = rt_shm_gettime();
+			pthread_mutex_unlock(&m->testmutex);
+			par->samples++;
 			if (par->max_cycles && par->samples >= par->max_cycles)
 				par->shutdown = 1;
 			if (mustgetcpu)
 				par->cpu = get_cpu();
-			nanosleep(&par->delay, NULL);
-			pthread_mutex_unlock(&syncmutex[par->num]);
+			sem_wait(&m->done);
+		} else {
+			/* Receiver */
+			sem_wait(&m->ready);
+			if (par->shutdown)
+				break;
+			ret = pthread_mutex_lock(&m->testmutex);
+			if (ret) {
+				snprintf(par->error, sizeof(par->error),
+				    "Could not lock %s mutex: %s\n",
+				    protocol_names[par->protocol],
+				    strerror(ret));
+				par->shutdown = 1;
+				neighbor->shutdown = 1;
+				sem_post(&m->done);
+				break;
+			}
+
+			/* ... Got the lock: End of latency measurement */
+			par->diff = (rt_shm_gettime() - stamp->ns) / 1000;
+			pthread_mutex_unlock(&m->testmutex);
+			update_latency(par, neighbor, hist);
+			if (mustgetcpu)
+				par->cpu = get_cpu();
+			sem_post(&m->done);
 		}
 	}
 	par->stopped = 1;
 	return NULL;
 }
 
+void *contenderthread(void *param)
+{
+	struct contender *con = param;
+	struct mutexes *m = rt_shm_slot(&shm, RT_SHM_SYNC, con->num);
+	struct sched_param schedp;
+	struct timespec pause;
+	cpu_set_t mask;
+	uint64_t end;
+
+	if (con->cpu != -1) {
+		CPU_ZERO(&mask);
+		CPU_SET(con->cpu, &mask);
+		if (sched_setaffinity(0, sizeof(mask), &mask) == -1)
+			fprintf(stderr, "WARNING: Could not set CPU affinity "
+				"to CPU #%d\n", con->cpu);
+	}
+
+	memset(&schedp, 0, sizeof(schedp));
+	schedp.sched_priority = con->priority;
+	if (con->priority > 0)
+		sched_setscheduler(0, SCHED_FIFO, &schedp);
+
+	pause.tv_sec = 0;
+	pause.tv_nsec = CONTENDER_PAUSE * 1000;
+
+	while (!con->shutdown) {
+		if (pthread_mutex_lock(&m->testmutex))
+			break;
+		end = rt_shm_gettime() + CONTENDER_HOLD * 1000;
+		while (rt_shm_gettime() < end)
+			;
+		pthread_mutex_unlock(&m->testmutex);
+		nanosleep(&pause, NULL);
+	}
+	con->stopped = 1;
+	return NULL;
+}
+
 
 static void display_help(void)
 {
@@ -170,10 +351,22 @@ static void display_help(void)
 	"-a [NUM] --affinity        run thread #N on processor #N, if possible\n"
 	"                           with NUM pin all threads to the processor NUM\n"
 	"-b USEC  --breaktrace=USEC send break trace command when latency > USEC\n"
+	"-c NUM   --contenders=NUM  threads per pair below the sender that take the\n"
+	"                           mutex as well on the sender's CPU, requires -m\n"
 	"-d DIST  --distance=DIST   distance of thread intervals in us default=500\n"
+	"-D       --duration=t      specify a length for the test run\n"
+	"                           default is in seconds, but 'm', 'h', or 'd' maybe added\n"
+	"                           to modify value to minutes, hours or days\n"
+	"-f       --fork            fork new processes instead of creating threads\n"
+	"-h       --histogram=US    dump a latency histogram to stdout after the run\n"
+	"                           US is the max time to be tracked in microseconds\n"
 	"-i INTV  --interval=INTV   base interval of thread in us default=1000\n"
 	"-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
+	"-m LIST  --mutex=LIST      comma separated list of mutex protocols, every\n"
+	"                           protocol gets its own thread pairs:\n"
+	"                           none, inherit (PI), protect (priority ceiling)\n"
 	"-p PRIO  --prio=PRIO       priority\n"
+	"-q       --quiet           print only a summary on exit\n"
 	"-S       --smp             SMP testing: options -a -t and same priority\n"
         "                           of all threads\n"
 	"-t       --threads         one thread per available processor\n"
@@ -192,13 +385,46 @@ static int num_threads = 1;
 static int max_cycles;
 static int interval = 1000;
 static int distance = 500;
+static int histogram;
+static int quiet;
+static int duration;
 static int smp;
 static int sameprio;
+static int contenders;
+static int use_protocol[NUM_PROTOCOLS];
+static int num_protocols;
+
+static int parse_protocols(char *list)
+{
+	char *name, *saveptr = NULL;
+	int i;
+
+	num_protocols = 0;
+	for (name = strtok_r(list, ",", &saveptr); name != NULL;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		for (i = 0; i < NUM_PROTOCOLS; i++)
+			if (!strcmp(name, protocol_names[i]))
+				break;
+		if (i == NUM_PROTOCOLS) {
+			fprintf(stderr, "ERROR: unknown mutex protocol %s\n",
+			    name);
+			return -1;
+		}
+		if (num_protocols == NUM_PROTOCOLS) {
+			fprintf(stderr, "ERROR: too many mutex protocols\n");
+			return -1;
+		}
+		use_protocol[num_protocols++] = i;
+	}
+	return num_protocols ? 0 : -1;
+}
 
 static void process_options (int argc, char *argv[])
 {
 	int error = 0;
 	int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	char *protocollist = NULL;
+	int i;
 
 	for (;;) {
 		int option_index = 0;
@@ -206,16 +432,22 @@ static void process_options (int argc, char *argv[])
 		static struct option long_options[] = {
 			{"affinity", optional_argument, NULL, 'a'},
 			{"breaktrace", required_argument, NULL, 'b'},
+			{"contenders", required_argument, NULL, 'c'},
 			{"distance", required_argument, NULL, 'd'},
+			{"duration", required_argument, NULL, 'D'},
+			{"fork", optional_argument, NULL, 'f'},
+			{"histogram", required_argument, NULL, 'h'},
 			{"interval", required_argument, NULL, 'i'},
 			{"loops", required_argument, NULL, 'l'},
+			{"mutex", required_argument, NULL, 'm'},
 			{"priority", required_argument, NULL, 'p'},
+			{"quiet", no_argument, NULL, 'q'},
 			{"smp", no_argument, NULL, 'S'},
 			{"threads", optional_argument, NULL, 't'},
 			{"help", no_argument, NULL, '?'},
 			{NULL, 0, NULL, 0}
 		};
-		int c = getopt_long (argc, argv, "a::b:d:i:l:p:St::",
+		int c = getopt_long (argc, argv, "a::b:c:d:D:f::h:i:l:m:p:qSt::",
 			long_options, &option_index);
 		if (c == -1)
 			break;
@@ -236,10 +468,26 @@ static void process_options (int argc, char *argv[])
 			}
 			break;
 		case 'b': tracelimit = atoi(optarg); break;
+		case 'c': contenders = atoi(optarg); break;
 		case 'd': distance = atoi(optarg); break;
+		case 'D': duration = parse_time_string(optarg); break;
+		case 'f':
+			if (optarg != NULL) {
+				wasforked = 1;
+				if (optarg[0] == 's')
+					wasforked_sender = 1;
+				else if (optarg[0] == 'r')
+					wasforked_sender = 0;
+				wasforked_threadno = atoi(optarg+1);
+			} else
+				mustfork = 1;
+			break;
+		case 'h': histogram = atoi(optarg); break;
 		case 'i': interval = atoi(optarg); break;
 		case 'l': max_cycles = atoi(optarg); break;
+		case 'm': protocollist = optarg; break;
 		case 'p': priority = atoi(optarg); break;
+		case 'q': quiet = 1; break;
 		case 'S':
 			smp = 1;
 			num_threads = max_cpus;
@@ -277,6 +525,35 @@ static void process_options (int argc, char *argv[])
 	if (priority < 0 || priority > 99)
 		error = 1;
 
+	if (histogram < 0)
+		error = 1;
+
+	if (histogram > RT_HIST_MAX)
+		histogram = RT_HIST_MAX;
+
+	if (duration < 0)
+		error = 1;
+
+	if (protocollist != NULL && parse_protocols(protocollist))
+		error = 1;
+
+	/* The priority ceiling needs a realtime priority to be raised to */
+	for (i = 0; i < num_protocols; i++) {
+		if (use_protocol[i] == PROTO_PROTECT && priority == 0) {
+			fprintf(stderr, "ERROR: protect requires -p\n");
+			error = 1;
+		}
+	}
+
+	if (contenders < 0 || (contenders && !num_protocols))
+		error = 1;
+
+	/* The sender of a mutex pair runs one below its receiver */
+	if (num_protocols && priority == 1) {
+		fprintf(stderr, "ERROR: -m requires -p 0 or at least 2\n");
+		error = 1;
+	}
+
 	if (num_threads < 1)
 		error = 1;
 
@@ -297,13 +574,19 @@ static void sighand(int sig)
 
 int main(int argc, char *argv[])
 {
-	int i;
+	int i, j, num_pairs;
 	int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
 	int oldsamples = 1;
 	struct params *receiver = NULL;
 	struct params *sender = NULL;
+	struct mutexes *m;
+	struct contender *contender = NULL;
+	pthread_mutexattr_t attr;
+	int startprio, startinterval;
 	sigset_t sigset;
-	struct timespec maindelay;
+	char f_opt[16];
+	struct timespec launchdelay, maindelay;
+	uint64_t stoptime;
 
 	process_options(argc, argv);
 
@@ -315,30 +598,109 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (wasforked) {
+		struct params *par;
+
+		if (wasforked_threadno == -1 || wasforked_sender == -1) {
+			fprintf(stderr, "Invalid fork option\n");
+			return 1;
+		}
+		if (rt_shm_attach(&shm, SHM_NAME, sizeof(struct params),
+		    sizeof(struct mutexes))) {
+			fprintf(stderr, "Could not attach shared memory: %s\n",
+			    errno == EPROTO ? "layout mismatch" :
+			    strerror(errno));
+			return 1;
+		}
+		if (wasforked_threadno >= rt_shm_num_pairs(&shm)) {
+			fprintf(stderr, "Invalid fork option\n");
+			rt_shm_detach(&shm);
+			return 1;
+		}
+		par = rt_shm_slot(&shm, wasforked_sender ? RT_SHM_SENDER :
+		    RT_SHM_RECEIVER, wasforked_threadno);
+		if (par->protocol == -1)
+			semathread(par);
+		else
+			mutexthread(par);
+		rt_shm_detach(&shm);
+		return 0;
+	}
+
 	signal(SIGINT, sighand);
 	signal(SIGTERM, sighand);
 
-	receiver = calloc(num_threads, sizeof(struct params));
-	sender = calloc(num_threads, sizeof(struct params));
-	if (receiver == NULL || sender == NULL)
-		goto nomem;
+	/* Every mutex protocol runs num_threads pairs of its own */
+	startprio = priority;
+	startinterval = interval;
+	num_pairs = num_threads * (num_protocols ? num_protocols : 1);
+	if (contenders) {
+		contender = calloc(num_pairs * contenders,
+		    sizeof(struct contender));
+		if (contender == NULL) {
+			perror("calloc");
+			return 1;
+		}
+	}
+
+	/*
+	 * The params and mutexes of all threads are in shared memory, see
+	 * rt-shm.h. In fork mode (-f), it is a named region that the
+	 * children attach to.
+	 */
+	if (rt_shm_create(&shm, mustfork ? SHM_NAME : NULL, num_pairs,
+	    sizeof(struct params), histogram ? rt_hist_size(histogram) : 0,
+	    sizeof(struct mutexes))) {
+		fprintf(stderr, "Could not create shared memory: %s\n",
+		    strerror(errno));
+		return 1;
+	}
+	receiver = rt_shm_slot(&shm, RT_SHM_RECEIVER, 0);
+	sender = rt_shm_slot(&shm, RT_SHM_SENDER, 0);
 
-	testmutex = (pthread_mutex_t *) calloc(num_threads, sizeof(pthread_mutex_t));
-	syncmutex = (pthread_mutex_t *) calloc(num_threads, sizeof(pthread_mutex_t));
-	if (testmutex == NULL || syncmutex == NULL)
-		goto nomem;
+	launchdelay.tv_sec = 0;
+	launchdelay.tv_nsec = 10000000; /* 10 ms */
 
-	for (i = 0; i < num_threads; i++) {
+	for (i = 0; i < num_pairs; i++) {
 		receiver[i].mindiff = UINT_MAX;
 		receiver[i].maxdiff = 0;
 		receiver[i].sumdiff = 0.0;
 
-
-		pthread_mutex_init(&testmutex[i], NULL);
-		pthread_mutex_init(&syncmutex[i], NULL);
+		/* Every protocol starts with the same priority and interval */
+		if (i % num_threads == 0) {
+			priority = startprio;
+			interval = startinterval;
+		}
+		receiver[i].protocol = num_protocols ?
+		    use_protocol[i / num_threads] : -1;
+
+		pthread_mutexattr_init(&attr);
+		if (mustfork)
+			pthread_mutexattr_setpshared(&attr,
+			    PTHREAD_PROCESS_SHARED);
+		if (receiver[i].protocol != -1) {
+			pthread_mutexattr_setprotocol(&attr,
+			    protocol_attr[receiver[i].protocol]);
+			if (receiver[i].protocol == PROTO_PROTECT)
+				pthread_mutexattr_setprioceiling(&attr,
+				    priority > 0 ? priority :
+				    sched_get_priority_min(SCHED_FIFO));
+		}
+		m = rt_shm_slot(&shm, RT_SHM_SYNC, i);
+		if (pthread_mutex_init(&m->testmutex, &attr) ||
+		    pthread_mutex_init(&m->syncmutex, &attr)) {
+			fprintf(stderr, "Could not create %s mutex\n",
+			    receiver[i].protocol == -1 ? "test" :
+			    protocol_names[receiver[i].protocol]);
+			return 1;
+		}
+		pthread_mutexattr_destroy(&attr);
+		sem_init(&m->ready, mustfork, 0);
+		sem_init(&m->done, mustfork, 0);
 
 		/* Wait on first attempt */
-		pthread_mutex_lock(&testmutex[i]);
+		if (receiver[i].protocol == -1)
+			pthread_mutex_lock(&m->testmutex);
 
 		receiver[i].num = i;
 		receiver[i].cpu = i;
@@ -355,37 +717,104 @@ int main(int argc, char *argv[])
 		receiver[i].delay.tv_nsec = (interval % USEC_PER_SEC) * 1000;
 		interval += distance;
 		receiver[i].max_cycles = max_cycles;
+		receiver[i].histogram = histogram;
 		receiver[i].sender = 0;
-		receiver[i].neighbor = &sender[i];
-		pthread_create(&receiver[i].threadid, NULL, semathread, &receiver[i]);
+		if (mustfork) {
+			pid_t pid = fork();
+			if (pid == -1) {
+				fprintf(stderr, "Could not fork\n");
+				return 1;
+			} else if (pid == 0) {
+				char *args[3];
+
+				receiver[i].pid = getpid();
+				sprintf(f_opt, "-fr%d", i);
+				args[0] = argv[0];
+				args[1] = f_opt;
+				args[2] = NULL;
+				execvp(args[0], args);
+				fprintf(stderr,
+				    "Could not execute receiver child process "
+				    "#%d\n", i);
+			}
+			nanosleep(&launchdelay, NULL);
+		} else
+			pthread_create(&receiver[i].threadid, NULL,
+			    receiver[i].protocol == -1 ? semathread :
+			    mutexthread, &receiver[i]);
 		memcpy(&sender[i], &receiver[i], sizeof(receiver[0]));
 		sender[i].sender = 1;
-		sender[i].neighbor = &receiver[i];
-		pthread_create(&sender[i].threadid, NULL, semathread, &sender[i]);
+		/*
+		 * With a protocol, the receiver that blocks on the mutex runs
+		 * above the sender that holds it, so that PI has something
+		 * to boost and the ceiling something to raise.
+		 */
+		if (sender[i].protocol != -1 && sender[i].priority > 0)
+			sender[i].priority--;
+		if (mustfork) {
+			pid_t pid = fork();
+			if (pid == -1) {
+				fprintf(stderr, "Could not fork\n");
+				return 1;
+			} else if (pid == 0) {
+				char *args[3];
+
+				sender[i].pid = getpid();
+				sprintf(f_opt, "-fs%d", i);
+				args[0] = argv[0];
+				args[1] = f_opt;
+				args[2] = NULL;
+				execvp(args[0], args);
+				fprintf(stderr,
+				    "Could not execute sender child process "
+				    "#%d\n", i);
+			}
+		} else
+			pthread_create(&sender[i].threadid, NULL,
+			    sender[i].protocol == -1 ? semathread :
+			    mutexthread, &sender[i]);
+
+		for (j = 0; j < contenders; j++) {
+			struct contender *con = &contender[i * contenders + j];
+
+			con->num = i;
+			con->cpu = sender[i].cpu;
+			con->priority = sender[i].priority - 1;
+			pthread_create(&con->threadid, NULL, contenderthread,
+			    con);
+		}
 	}
 
-	maindelay.tv_sec = 0;
-	maindelay.tv_nsec = 50000000; /* 50 ms */
+	rt_shm_maindelay(&maindelay, quiet);
 
+	stoptime = rt_shm_gettime() + duration * 1000000000ULL;
 	while (!shutdown) {
 		int printed;
 		int errorlines = 0;
 
-		for (i = 0; i < num_threads; i++)
+		for (i = 0; i < num_pairs; i++)
 			shutdown |= receiver[i].shutdown | sender[i].shutdown;
+		if (duration && rt_shm_gettime() >= stoptime)
+			shutdown = 1;
 
-		if (receiver[0].samples > oldsamples || shutdown) {
-			for (i = 0; i < num_threads; i++) {
+		if ((!quiet && receiver[0].samples > oldsamples) || shutdown) {
+			for (i = 0; i < num_pairs; i++) {
 				printf("#%1d: ID%d, P%d, CPU%d, I%ld; #%1d: ID%d, P%d, CPU%d, Cycles %d\n",
-				    i*2, receiver[i].tid, receiver[i].priority, receiver[i].cpu,
+				    i*2, mustfork ? receiver[i].pid : receiver[i].tid,
+				    receiver[i].priority, receiver[i].cpu,
 				    receiver[i].delay.tv_nsec / 1000,
-				    i*2+1, sender[i].tid, sender[i].priority, sender[i].cpu,
+				    i*2+1, mustfork ? sender[i].pid : sender[i].tid,
+				    sender[i].priority, sender[i].cpu,
 				    sender[i].samples);
 			}
-			for (i = 0; i < num_threads; i++) {
-				printf("#%d -> #%d, Min %4d, Cur %4d, Avg %4d, Max %4d\n",
-					i*2+1, i*2,
-					receiver[i].mindiff, (int) receiver[i].diff.tv_usec,
+			for (i = 0; i < num_pairs; i++) {
+				if (receiver[i].protocol != -1)
+					printf("#%d -> #%d, %-7s ", i*2+1, i*2,
+					    protocol_names[receiver[i].protocol]);
+				else
+					printf("#%d -> #%d, ", i*2+1, i*2);
+				printf("Min %4d, Cur %4d, Avg %4d, Max %4d\n",
+					receiver[i].mindiff, (int) receiver[i].diff,
 					(int) ((receiver[i].sumdiff / receiver[i].samples) + 0.5),
 					receiver[i].maxdiff);
 				if (receiver[i].error[0] != '\0') {
@@ -414,30 +843,60 @@ int main(int argc, char *argv[])
 		pthread_sigmask(SIG_SETMASK, &sigset, NULL);
 
 		if (printed && !shutdown)
-			printf("\033[%dA", num_threads*2 + errorlines);
+			printf("\033[%dA", num_pairs*2 + errorlines);
 	}
 
-	for (i = 0; i < num_threads; i++) {
+	for (i = 0; i < num_pairs * contenders; i++)
+		contender[i].shutdown = 1;
+	for (i = 0; i < num_pairs; i++) {
+		m = rt_shm_slot(&shm, RT_SHM_SYNC, i);
 		receiver[i].shutdown = 1;
 		sender[i].shutdown = 1;
-		pthread_mutex_unlock(&testmutex[i]);
-		pthread_mutex_unlock(&syncmutex[i]);
+		if (receiver[i].protocol == -1) {
+			pthread_mutex_unlock(&m->testmutex);
+			pthread_mutex_unlock(&m->syncmutex);
+		} else {
+			sem_post(&m->ready);
+			sem_post(&m->done);
+		}
 	}
 	nanosleep(&receiver[0].delay, NULL);
+	for (i = 0; i < num_pairs * contenders; i++)
+		pthread_join(contender[i].threadid, NULL);
+
+	for (i = 0; i < num_pairs; i++) {
+		if (!receiver[i].stopped) {
+			if (mustfork)
+				kill(receiver[i].pid, SIGTERM);
+			else
+				pthread_kill(receiver[i].threadid, SIGTERM);
+		}
+		if (!sender[i].stopped) {
+			if (mustfork)
+				kill(sender[i].pid, SIGTERM);
+			else
+				pthread_kill(sender[i].threadid, SIGTERM);
+		}
+	}
 
-	for (i = 0; i < num_threads; i++) {
-		if (!receiver[i].stopped)
-			pthread_kill(receiver[i].threadid, SIGTERM);
-		if (!sender[i].stopped)
-			pthread_kill(sender[i].threadid, SIGTERM);
+	for (i = 0; i < num_pairs; i++) {
+		m = rt_shm_slot(&shm, RT_SHM_SYNC, i);
+		pthread_mutex_destroy(&m->testmutex);
+		pthread_mutex_destroy(&m->syncmutex);
+		sem_destroy(&m->ready);
+		sem_destroy(&m->done);
 	}
+	free(contender);
+
+	if (histogram) {
+		struct rt_hist *hist[num_pairs];
 
-	for (i = 0; i < num_threads; i++) {
-		pthread_mutex_destroy(&testmutex[i]);
-		pthread_mutex_destroy(&syncmutex[i]);
+		for (i = 0; i < num_pairs; i++)
+			hist[i] = rt_shm_slot(&shm, RT_SHM_HIST, i);
+		rt_hist_print(hist, num_pairs, histogram);
 	}
 
- 	nomem:
+	rt_shm_destroy(&shm);
 
 	return 0;
 }
@@ -0,0 +1,741 @@
+/*
+ * ringtest.c
+ *
+ * Based on ptsematest.c
+ * Copyright (C) 2009 Carsten Emde <C.Emde@osadl.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
+#include <linux/unistd.h>
+#include <utmpx.h>
+#include "rt-utils.h"
+#include "rt-get_cpu.h"
+#include "error.h"
+
+#include <pthread.h>
+
+#define gettid() syscall(__NR_gettid)
+
+#define USEC_PER_SEC 1000000
+#define NSEC_PER_SEC 1000000000
+
+#define CACHELINE_SIZE 64
+#define DEFAULT_RING_SIZE 256
+#define DEFAULT_SPINS 1000
+#define STRATEGY_LOOPS 1000
+
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __asm__ __volatile__("pause" ::: "memory")
+#else
+#define cpu_relax() __sync_synchronize()
+#endif
+
+enum {
+	AFFINITY_UNSPECIFIED,
+	AFFINITY_SPECIFIED,
+	AFFINITY_USEALL
+};
+
+/* How the receiver waits for an empty ring to be filled */
+enum {
+	WAIT_SPIN,
+	WAIT_YIELD,
+	WAIT_FUTEX,
+	NUM_STRATEGIES
+};
+
+static char *strategy_names[NUM_STRATEGIES] = { "spin", "yield", "futex" };
+
+/*
+ * Single producer, single consumer ring. The producer only writes head
+ * and the slots, the consumer only writes tail and sleeping, so that
+ * the two sides never write to the same cache line.
+ */
+struct ring {
+	volatile unsigned int head __attribute__((aligned(CACHELINE_SIZE)));
+	volatile unsigned int tail __attribute__((aligned(CACHELINE_SIZE)));
+	volatile int sleeping;
+	unsigned int mask __attribute__((aligned(CACHELINE_SIZE)));
+	volatile uint64_t *slots;
+};
+
+struct params {
+	int num;
+	int cpu;
+	int priority;
+	int sender;
+	int samples;
+	int max_cycles;
+	int tracelimit;
+	int tid;
+	int shutdown;
+	int stopped;
+	int strategy;
+	int spins;
+	int batch;
+	struct timespec delay;
+	unsigned int mindiff, maxdiff;
+	double sumdiff;
+	long diff;
+	uint64_t start;
+	double cpuload;
+	pthread_t threadid;
+	struct ring *ring;
+	struct params *neighbor;
+	char error[MAX_PATH * 2];
+};
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static struct ring *ring_alloc(unsigned int size)
+{
+	struct ring *ring;
+	void *slots;
+
+	if (posix_memalign((void **) &ring, CACHELINE_SIZE, sizeof(*ring)))
+		return NULL;
+	if (posix_memalign(&slots, CACHELINE_SIZE, size * sizeof(uint64_t))) {
+		free(ring);
+		return NULL;
+	}
+	memset(ring, 0, sizeof(*ring));
+	memset(slots, 0, size * sizeof(uint64_t));
+	ring->mask = size - 1;
+	ring->slots = slots;
+	return ring;
+}
+
+static void ring_free(struct ring *ring)
+{
+	free((void *) ring->slots);
+	free(ring);
+}
+
+static void ring_wake(struct ring *ring)
+{
+	syscall(__NR_futex, &ring->head, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/*
+ * Wait until the ring is not empty anymore, i.e. head differs from the
+ * consumer's tail. After the spin count is exhausted, the yield strategy
+ * gives up the processor and the futex strategy goes to sleep on head.
+ * Return the new head, or tail if we are shutting down.
+ */
+static unsigned int ring_wait(struct params *par, struct ring *ring,
+			      unsigned int tail)
+{
+	unsigned int head;
+	int spins = 0;
+
+	while ((head = ring->head) == tail) {
+		if (par->shutdown)
+			break;
+		if (par->strategy == WAIT_SPIN || spins++ < par->spins) {
+			cpu_relax();
+			continue;
+		}
+		if (par->strategy == WAIT_YIELD) {
+			sched_yield();
+			continue;
+		}
+		ring->sleeping = 1;
+		__sync_synchronize();
+		if (ring->head == tail)
+			syscall(__NR_futex, &ring->head, FUTEX_WAIT_PRIVATE,
+			    tail, NULL, NULL, 0);
+		ring->sleeping = 0;
+	}
+	__sync_synchronize();
+	return head;
+}
+
+void *ringthread(void *param)
+{
+	int mustgetcpu = 0;
+	struct params *par = param;
+	struct ring *ring = par->ring;
+	unsigned int head = 0, tail = 0;
+	cpu_set_t mask;
+	int policy = SCHED_FIFO;
+	struct sched_param schedp;
+	int i;
+
+	memset(&schedp, 0, sizeof(schedp));
+	schedp.sched_priority = par->priority;
+	sched_setscheduler(0, policy, &schedp);
+
+	if (par->cpu != -1) {
+		CPU_ZERO(&mask);
+		CPU_SET(par->cpu, &mask);
+		if(sched_setaffinity(0, sizeof(mask), &mask) == -1)
+			snprintf(par->error, sizeof(par->error),
+			    "WARNING: Could not set CPU affinity "
+			    "to CPU #%d\n", par->cpu);
+	} else
+		mustgetcpu = 1;
+
+	par->tid = gettid();
+
+	while (!par->shutdown) {
+		if (par->sender) {
+			for (i = 0; i < par->batch && !par->shutdown; i++) {
+				/* Ring full: wait for the receiver */
+				while (head - ring->tail > ring->mask &&
+				    !par->shutdown)
+					sched_yield();
+
+				/* Publish entry: Start of latency measurement ... */
+				ring->slots[head & ring->mask] = get_time_ns();
+				__sync_synchronize();
+				ring->head = ++head;
+				if (par->strategy == WAIT_FUTEX) {
+					__sync_synchronize();
+					if (ring->sleeping)
+						ring_wake(ring);
+				}
+			}
+			par->samples++;
+			if (par->max_cycles && par->samples >= par->max_cycles)
+				par->shutdown = 1;
+			if (mustgetcpu)
+				par->cpu = get_cpu();
+			if (par->delay.tv_sec || par->delay.tv_nsec)
+				nanosleep(&par->delay, NULL);
+		} else {
+			/* Receiver */
+			head = ring_wait(par, ring, tail);
+
+			while (tail != head) {
+				uint64_t published = ring->slots[tail & ring->mask];
+				uint64_t now;
+
+				/* ... Got the entry: End of latency measurement */
+				now = get_time_ns();
+				__sync_synchronize();
+				ring->tail = ++tail;
+
+				if (par->start == 0)
+					par->start = now;
+				par->samples++;
+				par->diff = now - published;
+				if (par->diff < par->mindiff)
+					par->mindiff = par->diff;
+				if (par->diff > par->maxdiff)
+					par->maxdiff = par->diff;
+				par->sumdiff += (double) par->diff;
+			}
+
+			if (par->tracelimit &&
+			    par->maxdiff / 1000 > par->tracelimit) {
+				char tracing_enabled_file[MAX_PATH];
+
+				strcpy(tracing_enabled_file, get_debugfileprefix());
+				strcat(tracing_enabled_file, "tracing_enabled");
+				int tracing_enabled =
+				    open(tracing_enabled_file, O_WRONLY);
+				if (tracing_enabled >= 0) {
+					write(tracing_enabled, "0", 1);
+					close(tracing_enabled);
+				} else
+					snprintf(par->error, sizeof(par->error),
+					    "Could not access %s\n",
+					    tracing_enabled_file);
+				par->shutdown = 1;
+				par->neighbor->shutdown = 1;
+			}
+
+			if (par->max_cycles &&
+			    par->samples >= par->max_cycles * par->batch)
+				par->shutdown = 1;
+			if (mustgetcpu)
+				par->cpu = get_cpu();
+		}
+	}
+	par->stopped = 1;
+	return NULL;
+}
+
+
+static void display_help(void)
+{
+	printf("ringtest V %1.2f\n", VERSION_STRING);
+	puts("Usage: ringtest <options>");
+	puts("Function: test lock-free single producer single consumer ring "
+	    "handoff latency");
+	printf(
+	"Options:\n"
+	"-a [NUM] --affinity        run the receiver of pair #N on processor\n"
+	"                           #2N and the sender on #2N+1, if possible\n"
+	"                           with NUM pin all threads to the processor NUM\n"
+	"-b USEC  --breaktrace=USEC send break trace command when latency > USEC\n"
+	"-B NUM   --batch=NUM       number of entries published per cycle\n"
+	"                           default=1\n"
+	"-d DIST  --distance=DIST   distance of thread intervals in us default=500\n"
+	"-i INTV  --interval=INTV   base interval of thread in us default=1000\n"
+	"                           0 publishes without pause (throughput)\n"
+	"-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
+	"                           with several strategies, loops per strategy,\n"
+	"                           default=%d\n"
+	"-p PRIO  --prio=PRIO       priority\n"
+	"-r NUM   --ringsize=NUM    number of ring entries, a power of 2\n"
+	"                           default=%d\n"
+	"-s NUM   --spins=NUM       spin NUM times before yielding or sleeping\n"
+	"                           default=%d\n"
+	"-S       --smp             SMP testing: options -a -t and same priority\n"
+        "                           of all threads\n"
+	"-t       --threads         one thread per available processor\n"
+	"-t [NUM] --threads=NUM     number of threads:\n"
+	"                           without NUM, threads = max_cpus\n"
+	"                           without -t default = 1\n"
+	"-w LIST  --wait=LIST       comma separated list of receiver wait\n"
+	"                           strategies, every strategy gets its own\n"
+	"                           thread pairs, the strategies run one after\n"
+	"                           another, default=spin,yield,futex\n"
+	"                           without spin if the pair shares a CPU\n"
+	"Wait strategies:\n"
+	"spin     busy wait on the ring\n"
+	"yield    spin, then sched_yield()\n"
+	"futex    spin, then FUTEX_WAIT until the sender wakes us up\n",
+	STRATEGY_LOOPS, DEFAULT_RING_SIZE, DEFAULT_SPINS);
+	exit(1);
+}
+
+
+static int setaffinity = AFFINITY_UNSPECIFIED;
+static int affinity;
+static int tracelimit;
+static int priority;
+static int num_threads = 1;
+static int max_cycles;
+static int interval = 1000;
+static int distance = 500;
+static int smp;
+static int sameprio;
+static int batch = 1;
+static int ringsize = DEFAULT_RING_SIZE;
+static int spins = DEFAULT_SPINS;
+static int use_strategy[NUM_STRATEGIES];
+static int num_strategies;
+
+static int parse_strategies(char *list)
+{
+	char *name, *saveptr = NULL;
+	int i;
+
+	num_strategies = 0;
+	for (name = strtok_r(list, ",", &saveptr); name != NULL;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		for (i = 0; i < NUM_STRATEGIES; i++)
+			if (!strcmp(name, strategy_names[i]))
+				break;
+		if (i == NUM_STRATEGIES) {
+			fprintf(stderr, "ERROR: unknown wait strategy %s\n",
+			    name);
+			return -1;
+		}
+		if (num_strategies == NUM_STRATEGIES) {
+			fprintf(stderr, "ERROR: too many wait strategies\n");
+			return -1;
+		}
+		use_strategy[num_strategies++] = i;
+	}
+	return num_strategies ? 0 : -1;
+}
+
+/* Whether the sender and the receiver of a pair run on the same CPU */
+static int pair_shares_cpu(void)
+{
+	cpu_set_t mask;
+
+	switch (setaffinity) {
+	case AFFINITY_SPECIFIED:
+		return 1;
+	case AFFINITY_USEALL:
+		return sysconf(_SC_NPROCESSORS_CONF) == 1;
+	default:
+		return !sched_getaffinity(0, sizeof(mask), &mask) &&
+		    CPU_COUNT(&mask) == 1;
+	}
+}
+
+static void process_options (int argc, char *argv[])
+{
+	int i, error = 0;
+	int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	char *strategylist = NULL;
+
+	for (;;) {
+		int option_index = 0;
+		/** Options for getopt */
+		static struct option long_options[] = {
+			{"affinity", optional_argument, NULL, 'a'},
+			{"breaktrace", required_argument, NULL, 'b'},
+			{"batch", required_argument, NULL, 'B'},
+			{"distance", required_argument, NULL, 'd'},
+			{"interval", required_argument, NULL, 'i'},
+			{"loops", required_argument, NULL, 'l'},
+			{"priority", required_argument, NULL, 'p'},
+			{"ringsize", required_argument, NULL, 'r'},
+			{"spins", required_argument, NULL, 's'},
+			{"smp", no_argument, NULL, 'S'},
+			{"threads", optional_argument, NULL, 't'},
+			{"wait", required_argument, NULL, 'w'},
+			{"help", no_argument, NULL, '?'},
+			{NULL, 0, NULL, 0}
+		};
+		int c = getopt_long (argc, argv, "a::b:B:d:i:l:p:r:s:St::w:",
+			long_options, &option_index);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'a':
+			if (smp) {
+				warn("-a ignored due to --smp\n");
+				break;
+			}
+			if (optarg != NULL) {
+				affinity = atoi(optarg);
+				setaffinity = AFFINITY_SPECIFIED;
+			} else if (optind<argc && atoi(argv[optind])) {
+				affinity = atoi(argv[optind]);
+				setaffinity = AFFINITY_SPECIFIED;
+			} else {
+				setaffinity = AFFINITY_USEALL;
+			}
+			break;
+		case 'b': tracelimit = atoi(optarg); break;
+		case 'B': batch = atoi(optarg); break;
+		case 'd': distance = atoi(optarg); break;
+		case 'i': interval = atoi(optarg); break;
+		case 'l': max_cycles = atoi(optarg); break;
+		case 'p': priority = atoi(optarg); break;
+		case 'r': ringsize = atoi(optarg); break;
+		case 's': spins = atoi(optarg); break;
+		case 'S':
+			smp = 1;
+			num_threads = max_cpus;
+			setaffinity = AFFINITY_USEALL;
+			break;
+		case 't':
+			if (smp) {
+				warn("-t ignored due to --smp\n");
+				break;
+			}
+			if (optarg != NULL)
+				num_threads = atoi(optarg);
+			else if (optind<argc && atoi(argv[optind]))
+				num_threads = atoi(argv[optind]);
+			else
+				num_threads = max_cpus;
+			break;
+		case 'w': strategylist = optarg; break;
+		case '?': error = 1; break;
+		}
+	}
+
+	if (setaffinity == AFFINITY_SPECIFIED) {
+		if (affinity < 0)
+			error = 1;
+		if (affinity >= max_cpus) {
+			fprintf(stderr, "ERROR: CPU #%d not found, only %d CPUs available\n",
+			    affinity, max_cpus);
+			error = 1;
+		}
+	}
+
+	/* By default all strategies, spin only if it can run */
+	if (strategylist == NULL) {
+		num_strategies = 0;
+		for (i = 0; i < NUM_STRATEGIES; i++) {
+			if (i != WAIT_SPIN || !pair_shares_cpu())
+				use_strategy[num_strategies++] = i;
+		}
+	} else if (parse_strategies(strategylist))
+		error = 1;
+
+	if (num_threads < 0 || num_threads > 255)
+		error = 1;
+
+	if (priority < 0 || priority > 99)
+		error = 1;
+
+	if (num_threads < 1)
+		error = 1;
+
+	if (ringsize < 2 || (ringsize & (ringsize - 1))) {
+		fprintf(stderr, "ERROR: ring size must be a power of 2\n");
+		error = 1;
+	}
+
+	if (batch < 1 || batch > ringsize) {
+		fprintf(stderr, "ERROR: batch size must be between 1 and the "
+		    "ring size\n");
+		error = 1;
+	}
+
+	if (spins < 0 || interval < 0)
+		error = 1;
+
+	/*
+	 * A spinning receiver never gives up its CPU, a sender on the same
+	 * CPU would not get to publish anything.
+	 */
+	for (i = 0; i < num_strategies; i++) {
+		if (use_strategy[i] == WAIT_SPIN && pair_shares_cpu()) {
+			fprintf(stderr, "ERROR: spin requires the sender and "
+			    "the receiver on different CPUs\n");
+			error = 1;
+		}
+	}
+
+	/* The strategies run one after another, the first must end */
+	if (num_strategies > 1 && !max_cycles)
+		max_cycles = STRATEGY_LOOPS;
+
+	if (priority && smp)
+		sameprio = 1;
+
+	if (error)
+		display_help ();
+}
+
+
+static int volatile mustshutdown;
+
+static void sighand(int sig)
+{
+	mustshutdown = 1;
+}
+
+/*
+ * Run num_threads pairs with a wait strategy until one of them has taken
+ * max_cycles samples. The strategies run one after another, so that a
+ * spinning receiver does not take the CPU of another strategy's pair.
+ * Return -1 if we were interrupted or a pair did not stop, its threads
+ * might still use it.
+ */
+static int run_pairs(int strategy)
+{
+	int i, stop = 0, num_pairs = num_threads;
+	int prio = priority, intv = interval;
+	int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	int oldsamples = 1;
+	struct params *receiver, *sender;
+	sigset_t sigset;
+	struct timespec maindelay;
+
+	receiver = calloc(num_pairs, sizeof(struct params));
+	sender = calloc(num_pairs, sizeof(struct params));
+	if (receiver == NULL || sender == NULL)
+		return -1;
+
+	for (i = 0; i < num_pairs; i++) {
+		receiver[i].ring = ring_alloc(ringsize);
+		if (receiver[i].ring == NULL)
+			return -1;
+
+		receiver[i].mindiff = UINT_MAX;
+		receiver[i].maxdiff = 0;
+		receiver[i].sumdiff = 0.0;
+
+		receiver[i].num = i;
+		switch (setaffinity) {
+		case AFFINITY_UNSPECIFIED: receiver[i].cpu = -1; break;
+		case AFFINITY_SPECIFIED: receiver[i].cpu = affinity; break;
+		case AFFINITY_USEALL:
+			receiver[i].cpu = (i * 2) % max_cpus;
+			break;
+		}
+		receiver[i].priority = prio;
+		receiver[i].tracelimit = tracelimit;
+		if (prio > 1 && !sameprio)
+			prio--;
+		receiver[i].delay.tv_sec = intv / USEC_PER_SEC;
+		receiver[i].delay.tv_nsec = (intv % USEC_PER_SEC) * 1000;
+		intv += distance;
+		receiver[i].max_cycles = max_cycles;
+		receiver[i].strategy = strategy;
+		receiver[i].spins = spins;
+		receiver[i].batch = batch;
+		receiver[i].sender = 0;
+		receiver[i].neighbor = &sender[i];
+		pthread_create(&receiver[i].threadid, NULL, ringthread, &receiver[i]);
+		memcpy(&sender[i], &receiver[i], sizeof(receiver[0]));
+		sender[i].sender = 1;
+		if (setaffinity == AFFINITY_USEALL)
+			sender[i].cpu = (i * 2 + 1) % max_cpus;
+		sender[i].neighbor = &receiver[i];
+		pthread_create(&sender[i].threadid, NULL, ringthread, &sender[i]);
+	}
+
+	maindelay.tv_sec = 0;
+	maindelay.tv_nsec = 50000000; /* 50 ms */
+
+	while (!stop) {
+		int printed;
+		int errorlines = 0;
+
+		stop = mustshutdown;
+		for (i = 0; i < num_pairs; i++)
+			stop |= receiver[i].shutdown | sender[i].shutdown;
+
+		if (receiver[0].samples > oldsamples || stop) {
+			uint64_t now = get_time_ns();
+
+			for (i = 0; i < num_pairs; i++) {
+				printf("#%1d: ID%d, P%d, CPU%d, I%ld; #%1d: ID%d, P%d, CPU%d, Cycles %d\n",
+				    i*2, receiver[i].tid, receiver[i].priority, receiver[i].cpu,
+				    receiver[i].delay.tv_nsec / 1000,
+				    i*2+1, sender[i].tid, sender[i].priority, sender[i].cpu,
+				    sender[i].samples);
+			}
+			for (i = 0; i < num_pairs; i++) {
+				struct params *par = &receiver[i];
+				double elapsed, rate = 0.0;
+				clockid_t clock;
+				struct timespec ts;
+
+				/* Throughput and CPU time of the receiver */
+				if (par->start && now > par->start) {
+					elapsed = (double) (now - par->start);
+					rate = par->samples * 1e9 / elapsed;
+					if (!par->stopped &&
+					    !pthread_getcpuclockid(par->threadid, &clock) &&
+					    !clock_gettime(clock, &ts))
+						par->cpuload = (ts.tv_sec * 1e9 +
+						    ts.tv_nsec) * 100.0 / elapsed;
+				}
+				if (par->samples == 0)
+					printf("#%d -> #%d, %-5s (not yet ready)\n",
+					    i*2+1, i*2, strategy_names[strategy]);
+				else
+					printf("#%d -> #%d, %-5s Min %6d, Cur %6d, Avg %6d, Max %6d ns, %9.0f/s, CPU %3.0f%%\n",
+					    i*2+1, i*2, strategy_names[strategy],
+					    par->mindiff, (int) par->diff,
+					    (int) ((par->sumdiff / par->samples) + 0.5),
+					    par->maxdiff, rate,
+					    par->cpuload > 100.0 ? 100.0 : par->cpuload);
+				if (receiver[i].error[0] != '\0') {
+					printf("%s", receiver[i].error);
+					errorlines++;
+					receiver[i].error[0] = '\0';
+				}
+				if (sender[i].error[0] != '\0') {
+					printf("%s", sender[i].error);
+					errorlines++;
+					sender[i].error[0] = '\0';
+				}
+			}
+			printed = 1;
+		} else
+			printed = 0;
+
+		sigemptyset(&sigset);
+		sigaddset(&sigset, SIGTERM);
+		sigaddset(&sigset, SIGINT);
+		pthread_sigmask(SIG_SETMASK, &sigset, NULL);
+
+		if (!stop)
+			nanosleep(&maindelay, NULL);
+
+		sigemptyset(&sigset);
+		pthread_sigmask(SIG_SETMASK, &sigset, NULL);
+
+		if (printed && !stop)
+			printf("\033[%dA", num_pairs*2 + errorlines);
+	}
+
+	for (i = 0; i < num_pairs; i++) {
+		receiver[i].shutdown = 1;
+		sender[i].shutdown = 1;
+		ring_wake(receiver[i].ring);
+	}
+	nanosleep(&maindelay, NULL);
+
+	for (i = 0; i < num_pairs; i++) {
+		if (!receiver[i].stopped)
+			pthread_kill(receiver[i].threadid, SIGTERM);
+		if (!sender[i].stopped)
+			pthread_kill(sender[i].threadid, SIGTERM);
+	}
+	nanosleep(&maindelay, NULL);
+
+	/* Not freed if a thread is left, it might still use it */
+	for (i = 0; i < num_pairs; i++) {
+		if (!receiver[i].stopped || !sender[i].stopped)
+			return -1;
+	}
+	for (i = 0; i < num_pairs; i++) {
+		pthread_join(receiver[i].threadid, NULL);
+		pthread_join(sender[i].threadid, NULL);
+		ring_free(receiver[i].ring);
+	}
+	free(sender);
+	free(receiver);
+	return mustshutdown ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	process_options(argc, argv);
+
+	if (check_privs())
+		return 1;
+
+	if (mlockall(MCL_CURRENT|MCL_FUTURE) == -1) {
+		perror("mlockall");
+		return 1;
+	}
+
+	get_cpu_setup();
+
+	signal(SIGINT, sighand);
+	signal(SIGTERM, sighand);
+
+	for (i = 0; i < num_strategies; i++) {
+		if (run_pairs(use_strategy[i]))
+			break;
+	}
+
+	return 0;
+}
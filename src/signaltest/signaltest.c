@@ -9,10 +9,14 @@
  *
  */
 
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -21,13 +25,14 @@
 
 #include <linux/unistd.h>
 
-#include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/mman.h>
 
 #include "rt-utils.h"
+#include "rt-signal.h"
+#include "rt-hist.h"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -40,11 +45,17 @@
 /* Must be power of 2 ! */
 #define VALBUF_SIZE		16384
 
+/* Stack that a thread touches before it measures, see prefault_stack() */
+#define PREFAULT_STACK		(64 * 1024)
+
 /* Struct to transfer parameters to the thread */
 struct thread_param {
 	int id;
 	int prio;
 	int signal;
+	int mode;
+	int queued;
+	int cpu;
 	unsigned long max_cycles;
 	struct thread_stat *stats;
 	int bufmsk;
@@ -59,30 +70,65 @@ struct thread_stat {
 	long act;
 	double avg;
 	long *values;
+	struct rt_hist *hist;
 	pthread_t thread;
 	pthread_t tothread;
 	int threadstarted;
 	int tid;
+	int cpu;
 };
 
+/*
+ * A signal that travels the ring. The first thread stamps when it starts
+ * a round trip, every thread stamps when it passes the signal on, so the
+ * next thread can measure its hop. With -B, several signals are in
+ * flight and the payload tells which one arrived.
+ */
+struct ring_token {
+	uint64_t start;
+	uint64_t sent;
+} __attribute__((aligned(64)));
+
 static int shutdown;
 static int tracelimit = 0;
-static int oldtrace = 0;
+static int tracesnapshot;
+static int trace_fd = -1;
+static struct ring_token *tokens;
+static int num_tokens = 1;
+static struct thread_stat ringstat;
+static int histogram;
+static int lockall = 0;
 
-static inline void tsnorm(struct timespec *ts)
+static inline uint64_t ts2ns(struct timespec *ts)
 {
-	while (ts->tv_nsec >= NSEC_PER_SEC) {
-		ts->tv_nsec -= NSEC_PER_SEC;
-		ts->tv_sec++;
-	}
+	return (uint64_t) ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
 }
 
-static inline long calcdiff(struct timespec t1, struct timespec t2)
+static void update_stat(struct thread_stat *stat, long diff, int bufmsk)
+{
+	if (diff < stat->min)
+		stat->min = diff;
+	if (diff > stat->max)
+		stat->max = diff;
+	stat->avg += (double) diff;
+	stat->act = diff;
+	stat->cycles++;
+
+	if (bufmsk)
+		stat->values[stat->cycles & bufmsk] = diff;
+	if (stat->hist)
+		rt_hist_add(stat->hist, histogram, diff);
+}
+
+/*
+ * With locked memory, fault in the stack that the measuring loop may
+ * grow into, so that it does not take a page fault later.
+ */
+static void prefault_stack(void)
 {
-	long diff;
-	diff = USEC_PER_SEC * ((int) t1.tv_sec - (int) t2.tv_sec);
-	diff += ((int) t1.tv_nsec - (int) t2.tv_nsec) / 1000;
-	return diff;
+	volatile char stack[PREFAULT_STACK];
+
+	memset((char *) stack, 0, sizeof(stack));
 }
 
 /*
@@ -93,31 +139,34 @@ void *signalthread(void *param)
 {
 	struct thread_param *par = param;
 	struct sched_param schedp;
-	sigset_t sigset;
-	struct timespec before, after;
+	struct rt_signal_waiter waiter;
 	struct thread_stat *stat = par->stats;
 	int policy = par->prio ? SCHED_FIFO : SCHED_OTHER;
+	unsigned int passes = 0;	/* of the first thread */
 	int stopped = 0;
-	int first = 1;
-
-	if (tracelimit) {
-		system("echo 1 > /proc/sys/kernel/trace_all_cpus");
-		system("echo 1 > /proc/sys/kernel/trace_enabled");
-		system("echo 1 > /proc/sys/kernel/trace_freerunning");
-		system("echo 0 > /proc/sys/kernel/trace_print_at_crash");
-		system("echo 1 > /proc/sys/kernel/trace_user_triggered");
-		system("echo -1 > /proc/sys/kernel/trace_user_trigger_irq");
-		system("echo 0 > /proc/sys/kernel/trace_verbose");
-		system("echo 0 > /proc/sys/kernel/preempt_thresh");
-		system("echo 0 > /proc/sys/kernel/wakeup_timing");
-		system("echo 0 > /proc/sys/kernel/preempt_max_latency");
-	}
 
 	stat->tid = gettid();
 
-	sigemptyset(&sigset);
-	sigaddset(&sigset, par->signal);
-	sigprocmask(SIG_BLOCK, &sigset, NULL);
+	if (rt_signal_init(&waiter, par->mode, par->signal)) {
+		fprintf(stderr, "Could not set up %s: %s\n",
+			rt_signal_mode_names[par->mode], strerror(errno));
+		shutdown = 1;
+		goto out;
+	}
+
+	if (par->cpu != -1) {
+		cpu_set_t mask;
+
+		CPU_ZERO(&mask);
+		CPU_SET(par->cpu, &mask);
+		if (sched_setaffinity(0, sizeof(mask), &mask) == -1)
+			fprintf(stderr, "WARNING: Could not set CPU affinity "
+				"to CPU #%d\n", par->cpu);
+	}
+	stat->cpu = sched_getcpu();
+
+	if (lockall)
+		prefault_stack();
 
 	memset(&schedp, 0, sizeof(schedp));
 	schedp.sched_priority = par->prio;
@@ -125,70 +174,83 @@ void *signalthread(void *param)
 
 	stat->threadstarted++;
 
-	if (tracelimit) {
-		if (oldtrace)
-			gettimeofday(0,(struct timezone *)1);
-		else
-			prctl(0, 1);
-	}
-
-	clock_gettime(CLOCK_MONOTONIC, &before);
-
 	while (!shutdown) {
-		struct timespec now;
-		long diff;
+		struct timespec now, after;
+		struct ring_token *token;
+		uintptr_t payload;
+		long diff, ringdiff = 0;
 		int sigs;
 
-		if (sigwait(&sigset, &sigs) < 0)
+		sigs = rt_signal_wait(&waiter, &payload);
+		if (sigs < 0)
 			goto out;
+		if (sigs == 0)
+			continue;
 
 		clock_gettime(CLOCK_MONOTONIC, &after);
 
-		/*
-		 * If it is the first thread, sleep after every 16
-		 * round trips.
-		 */
-		if (!par->id && !(stat->cycles & 0x0F))
-			usleep(10000);
-
-		/* Get current time */
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		pthread_kill(stat->tothread, SIGUSR1);
-
-		/* Skip the first cycle */
-		if (first) {
-			first = 0;
-			before = now;
-			continue;
+		/* sigwait() does not see the payload, -B needs it */
+		if (par->queued && par->mode != RT_SIGNAL_SIGWAIT &&
+		    payload < num_tokens)
+			token = &tokens[payload];
+		else
+			token = &tokens[0];
+		stat->cpu = sched_getcpu();
+
+		/* The hop from the previous thread, once it has sent */
+		diff = -1;
+		if (token->sent) {
+			diff = (ts2ns(&after) - token->sent) / 1000;
+			update_stat(stat, diff, par->bufmsk);
 		}
 
-		diff = calcdiff(after, before);
-		before = now;
-		if (diff < stat->min)
-			stat->min = diff;
-		if (diff > stat->max)
-			stat->max = diff;
-		stat->avg += (double) diff;
+		if (!par->id) {
+			if (token->start) {
+				ringdiff = (ts2ns(&after) - token->start) /
+					1000;
+				update_stat(&ringstat, ringdiff, par->bufmsk);
+			}
+
+			/*
+			 * If it is the first thread, sleep after every 16
+			 * round trips. With -B, the other signals would pile
+			 * up behind the sleep and their latency with them.
+			 */
+			if (num_tokens == 1 && !(passes++ & 0x0F))
+				usleep(10000);
+		}
 
-		if (!stopped && tracelimit && (diff > tracelimit)) {
+		/* Get current time */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (!par->id)
+			token->start = ts2ns(&now);
+		token->sent = ts2ns(&now);
+		if (par->queued) {
+			union sigval value;
+
+			value.sival_ptr = (void *) (uintptr_t)
+				(token - tokens);
+			pthread_sigqueue(stat->tothread, par->signal, value);
+		} else
+			pthread_kill(stat->tothread, par->signal);
+
+		if (!stopped && tracelimit &&
+		    (diff > tracelimit || ringdiff > tracelimit)) {
 			stopped++;
-			if (oldtrace)
-				gettimeofday(0,0);
-			else
-				prctl(0, 0);
+			/* Stop tracing, or take a snapshot with -S */
+			if (trace_fd >= 0)
+				write(trace_fd, tracesnapshot ? "1" : "0", 1);
 			shutdown++;
 		}
-		stat->act = diff;
-		stat->cycles++;
 
-		if (par->bufmsk)
-			stat->values[stat->cycles & par->bufmsk] = diff;
-
-		if (par->max_cycles && par->max_cycles == stat->cycles)
+		if (par->max_cycles && par->max_cycles == (par->id ?
+		    stat->cycles : ringstat.cycles))
 			break;
 	}
 
 out:
+	rt_signal_cleanup(&waiter);
+
 	/* switch to normal */
 	schedp.sched_priority = 0;
 	sched_setscheduler(0, SCHED_OTHER, &schedp);
@@ -205,14 +267,34 @@ static void display_help(void)
 	printf("signaltest V %1.2f\n", VERSION_STRING);
 	printf("Usage:\n"
 	       "signaltest <options>\n\n"
+	       "-a [CPUS] --affinity=CPUS  run the threads of the ring on the CPUs of\n"
+	       "                           the list in turn, e.g. 0-3,8\n"
+	       "                           without CPUS, on all CPUs in turn\n"
 	       "-b USEC  --breaktrace=USEC send break trace command when latency > USEC\n"
+	       "                           tracing is switched on at start and off\n"
+	       "                           when the latency is exceeded\n"
+	       "-B NUM   --burst=NUM       start the ring with NUM signals, requires -s\n"
+	       "                           and a mode that sees the payload\n"
+	       "-D       --duration=t      specify a length for the test run\n"
+	       "                           default is in seconds, but 'm', 'h', or 'd' maybe added\n"
+	       "                           to modify value to minutes, hours or days\n"
+	       "-h       --histogram=US    dump a latency histogram to stdout after the run\n"
+	       "                           US is the max time to be tracked in microseconds\n"
+	       "                           one column per hop, the last one is the ring\n"
 	       "-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
 	       "-p PRIO  --prio=PRIO       priority of highest prio thread\n"
 	       "-q       --quiet           print only a summary on exit\n"
+	       "-S       --snapshot        with -b, take a snapshot of the trace instead\n"
+	       "                           of switching tracing off\n"
+	       "-s       --sigqueue        pass a queued realtime signal with sigqueue()\n"
+	       "                           that tells which signal of the ring it is\n"
 	       "-t NUM   --threads=NUM     number of threads: default=2\n"
 	       "-m       --mlockall        lock current and future memory allocations\n"
+	       "                           and prefault the stacks of the threads\n"
 	       "-v       --verbose         output values on stdout for statistics\n"
-	       "                           format: n:c:v n=tasknum c=count v=value in us\n");
+	       "                           format: n:c:v n=tasknum c=count v=value in us\n"
+	       "-w MODE  --wait=MODE       receive mode: sigwait, sigwaitinfo, sigtimedwait,\n"
+	       "                           signalfd default=sigwait\n");
 	exit(0);
 }
 
@@ -221,38 +303,84 @@ static int num_threads = 2;
 static int max_cycles;
 static int verbose;
 static int quiet;
-static int lockall = 0;
+static int duration;
+static int mode = RT_SIGNAL_SIGWAIT;
+static int queued;
+static int *cpus;
+static int num_cpus;
 
 /* Process commandline options */
 static void process_options (int argc, char *argv[])
 {
 	int error = 0;
+	int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+
 	for (;;) {
 		int option_index = 0;
 		/** Options for getopt */
 		static struct option long_options[] = {
+			{"affinity", optional_argument, NULL, 'a'},
 			{"breaktrace", required_argument, NULL, 'b'},
+			{"burst", required_argument, NULL, 'B'},
+			{"duration", required_argument, NULL, 'D'},
+			{"histogram", required_argument, NULL, 'h'},
 			{"loops", required_argument, NULL, 'l'},
 			{"priority", required_argument, NULL, 'p'},
 			{"quiet", no_argument, NULL, 'q'},
+			{"sigqueue", no_argument, NULL, 's'},
+			{"snapshot", no_argument, NULL, 'S'},
 			{"threads", required_argument, NULL, 't'},
 			{"verbose", no_argument, NULL, 'v'},
 			{"mlockall", no_argument, NULL, 'm'},
+			{"wait", required_argument, NULL, 'w'},
 			{"help", no_argument, NULL, '?'},
 			{NULL, 0, NULL, 0}
 		};
-		int c = getopt_long (argc, argv, "b:c:d:i:l:np:qrsmt:v",
+		int c = getopt_long (argc, argv, "a::b:B:c:d:D:h:i:l:np:qrsSmt:vw:",
 			long_options, &option_index);
 		if (c == -1)
 			break;
 		switch (c) {
+		case 'a':
+			cpus = calloc(max_cpus, sizeof(int));
+			if (cpus == NULL)
+				break;
+			if (optarg == NULL && optind < argc &&
+			    isdigit(argv[optind][0]))
+				optarg = argv[optind++];
+			if (optarg == NULL) {
+				for (num_cpus = 0; num_cpus < max_cpus;
+				     num_cpus++)
+					cpus[num_cpus] = num_cpus;
+				break;
+			}
+			num_cpus = parse_cpulist(optarg, cpus, max_cpus);
+			if (num_cpus < 1) {
+				fprintf(stderr, "ERROR: invalid CPU list %s\n",
+					optarg);
+				error = 1;
+			}
+			break;
 		case 'b': tracelimit = atoi(optarg); break;
+		case 'B': num_tokens = atoi(optarg); break;
+		case 'D': duration = parse_time_string(optarg); break;
+		case 'h': histogram = atoi(optarg); break;
 		case 'l': max_cycles = atoi(optarg); break;
 		case 'p': priority = atoi(optarg); break;
 		case 'q': quiet = 1; break;
+		case 's': queued = 1; break;
+		case 'S': tracesnapshot = 1; break;
 		case 't': num_threads = atoi(optarg); break;
 		case 'm': lockall = 1; break;
 		case 'v': verbose = 1; break;
+		case 'w':
+			mode = rt_signal_parse_mode(optarg);
+			if (mode < 0) {
+				fprintf(stderr, "ERROR: unknown receive mode %s\n",
+					optarg);
+				error = 1;
+			}
+			break;
 		case '?': error = 1; break;
 		}
 	}
@@ -263,23 +391,69 @@ static void process_options (int argc, char *argv[])
 	if (num_threads < 2)
 		error = 1;
 
+	if (num_tokens < 1)
+		error = 1;
+
+	if (histogram < 0 || duration < 0)
+		error = 1;
+
+	if (histogram > RT_HIST_MAX)
+		histogram = RT_HIST_MAX;
+
+	/*
+	 * Standard signals do not queue, and the signals in flight are
+	 * told apart by their payload.
+	 */
+	if (num_tokens > 1 && (!queued || mode == RT_SIGNAL_SIGWAIT)) {
+		fprintf(stderr, "ERROR: -B requires -s and a mode other "
+			"than sigwait\n");
+		error = 1;
+	}
+
 	if (error)
 		display_help ();
 }
 
-static void check_kernel(void)
+/*
+ * Open the tracefs file that -b writes to when the latency is exceeded,
+ * so that the measuring threads only need a write(). Tracing is switched
+ * on here. With -S, the snapshot buffer is allocated and cleared up
+ * front, and the break takes a snapshot while the trace goes on.
+ */
+static int setup_tracing(void)
 {
-	size_t len;
-	char ver[256];
-	int fd, maj, min, sub;
+	char path[MAX_PATH];
+	char *prefix = get_debugfileprefix();
+	int fd;
+
+	if (prefix[0] == '\0') {
+		fprintf(stderr, "WARNING: tracefs not found, -b only stops "
+			"the test\n");
+		return 0;
+	}
 
-	fd = open("/proc/version", O_RDONLY, 0666);
-	len = read(fd, ver, 255);
+	snprintf(path, sizeof(path), "%stracing_on", prefix);
+	fd = open(path, O_WRONLY);
+	if (fd < 0 || write(fd, "1", 1) != 1)
+		goto err;
+	if (!tracesnapshot) {
+		trace_fd = fd;
+		return 0;
+	}
 	close(fd);
-	ver[len-1] = 0x0;
-	sscanf(ver, "Linux version %d.%d.%d", &maj, &min, &sub);
-	if (maj == 2 && min == 6 && sub < 18)
-		oldtrace = 1;
+
+	snprintf(path, sizeof(path), "%ssnapshot", prefix);
+	fd = open(path, O_WRONLY);
+	if (fd < 0 || write(fd, "1", 1) != 1 || write(fd, "2", 1) != 1)
+		goto err;
+	trace_fd = fd;
+	return 0;
+err:
+	fprintf(stderr, "ERROR: Could not access %s: %s\n", path,
+		strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	return -1;
 }
 
 static void sighand(int sig)
@@ -287,40 +461,93 @@ static void sighand(int sig)
 	shutdown = 1;
 }
 
-static void print_stat(struct thread_param *par, int index, int verbose)
+static int read_topology(int cpu, char *name)
 {
-	struct thread_stat *stat = par->stats;
+	char path[MAX_PATH];
+	FILE *f;
+	int val = -1;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	if (fscanf(f, "%d", &val) != 1)
+		val = -1;
+	fclose(f);
+	return val;
+}
 
-	if (!verbose) {
-		if (quiet != 1) {
-			printf("T:%2d (%5d) P:%2d C:%7lu "
-			       "Min:%7ld Act:%5ld Avg:%5ld Max:%8ld\n",
-			       index, stat->tid, par->prio,
-			       stat->cycles, stat->min, stat->act,
-			       stat->cycles ?
-			       (long)(stat->avg/stat->cycles) : 0, stat->max);
-		}
-	} else {
-		while (stat->cycles != stat->cyclesread) {
-			long diff = stat->values[stat->cyclesread & par->bufmsk];
-			printf("%8d:%8lu:%8ld\n", index, stat->cyclesread, diff);
-			stat->cyclesread++;
-		}
+/* How far a hop reaches: same CPU, SMT sibling, other core or socket */
+static char *hop_kind(int from, int to)
+{
+	int pkg_from, pkg_to, core_from, core_to;
+
+	if (from < 0 || to < 0)
+		return "?";
+	if (from == to)
+		return "cpu";
+	pkg_from = read_topology(from, "physical_package_id");
+	pkg_to = read_topology(to, "physical_package_id");
+	core_from = read_topology(from, "core_id");
+	core_to = read_topology(to, "core_id");
+	if (pkg_from < 0 || pkg_to < 0 || core_from < 0 || core_to < 0)
+		return "?";
+	if (pkg_from != pkg_to)
+		return "socket";
+	if (core_from != core_to)
+		return "core";
+	return "smt";
+}
+
+static void print_values(struct thread_stat *stat, int index, int bufmsk)
+{
+	while (stat->cycles != stat->cyclesread) {
+		long diff = stat->values[stat->cyclesread & bufmsk];
+		printf("%8d:%8lu:%8ld\n", index, stat->cyclesread, diff);
+		stat->cyclesread++;
 	}
 }
 
+/* The round trip of the whole ring, as seen by the first thread */
+static void print_ring(void)
+{
+	printf("R: (%3d threads)      C:%7lu "
+	       "Min:%7ld Act:%5ld Avg:%5ld Max:%8ld\n",
+	       num_threads, ringstat.cycles, ringstat.min, ringstat.act,
+	       ringstat.cycles ?
+	       (long)(ringstat.avg/ringstat.cycles) : 0, ringstat.max);
+}
+
+/* The hop from the previous thread of the ring to this one */
+static void print_hop(struct thread_param *par, struct thread_stat *prev,
+		      int index)
+{
+	struct thread_stat *stat = par->stats;
+
+	printf("T:%2d (%5d) P:%2d CPU:%3d->%3d %-6s C:%7lu "
+	       "Min:%7ld Act:%5ld Avg:%5ld Max:%8ld\n",
+	       index, stat->tid, par->prio, prev->cpu, stat->cpu,
+	       hop_kind(prev->cpu, stat->cpu), stat->cycles, stat->min,
+	       stat->act, stat->cycles ?
+	       (long)(stat->avg/stat->cycles) : 0, stat->max);
+}
+
 int main(int argc, char **argv)
 {
 	sigset_t sigset;
-	int signum = SIGUSR1;
+	int signum;
 	struct thread_param *par;
 	struct thread_stat *stat;
+	struct timespec ts;
+	uint64_t stoptime;
 	int i, ret = -1;
 
 	if (check_privs())
 		exit(-1);
 
 	process_options(argc, argv);
+	signum = queued ? SIGRTMIN : SIGUSR1;
 
 	/* lock all memory (prevent paging) */
 	if (lockall)
@@ -328,8 +555,9 @@ int main(int argc, char **argv)
 			perror("mlockall");
 			goto out;
 		}
-		
-	check_kernel();
+
+	if (tracelimit && setup_tracing())
+		goto out;
 
 	sigemptyset(&sigset);
 	sigaddset(&sigset, signum);
@@ -344,6 +572,23 @@ int main(int argc, char **argv)
 	stat = calloc(num_threads, sizeof(struct thread_stat));
 	if (!stat)
 		goto outpar;
+	if (posix_memalign((void **) &tokens, sizeof(struct ring_token),
+			   num_tokens * sizeof(struct ring_token)))
+		goto outstat;
+	memset(tokens, 0, num_tokens * sizeof(struct ring_token));
+
+	ringstat.min = 1000000;
+	ringstat.max = -1000000;
+	if (verbose) {
+		ringstat.values = calloc(VALBUF_SIZE, sizeof(long));
+		if (!ringstat.values)
+			goto outall;
+	}
+	if (histogram) {
+		ringstat.hist = calloc(1, rt_hist_size(histogram));
+		if (!ringstat.hist)
+			goto outall;
+	}
 
 	for (i = 0; i < num_threads; i++) {
 		if (verbose) {
@@ -352,6 +597,11 @@ int main(int argc, char **argv)
 				goto outall;
 			par[i].bufmsk = VALBUF_SIZE - 1;
 		}
+		if (histogram) {
+			stat[i].hist = calloc(1, rt_hist_size(histogram));
+			if (!stat[i].hist)
+				goto outall;
+		}
 
 		par[i].id = i;
 		par[i].prio = priority;
@@ -360,11 +610,15 @@ int main(int argc, char **argv)
 			priority--;
 #endif
 		par[i].signal = signum;
+		par[i].mode = mode;
+		par[i].queued = queued;
+		par[i].cpu = num_cpus ? cpus[i % num_cpus] : -1;
 		par[i].max_cycles = max_cycles;
 		par[i].stats = &stat[i];
 		stat[i].min = 1000000;
 		stat[i].max = -1000000;
 		stat[i].avg = 0.0;
+		stat[i].cpu = -1;
 		stat[i].threadstarted = 1;
 		pthread_create(&stat[i].thread, NULL, signalthread, &par[i]);
 	}
@@ -384,8 +638,18 @@ int main(int argc, char **argv)
 		stat[i].tothread = stat[0].thread;
 		break;
 	}
-	pthread_kill(stat[0].thread, signum);
+	if (queued) {
+		for (i = 0; i < num_tokens; i++) {
+			union sigval value;
 
+			value.sival_ptr = (void *) (uintptr_t) i;
+			pthread_sigqueue(stat[0].thread, signum, value);
+		}
+	} else
+		pthread_kill(stat[0].thread, signum);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	stoptime = ts2ns(&ts) + duration * (uint64_t) NSEC_PER_SEC;
 	while (!shutdown) {
 		char lavg[256];
 		int fd, len, allstopped = 0;
@@ -396,10 +660,13 @@ int main(int argc, char **argv)
 			close(fd);
 			lavg[len-1] = 0x0;
 			printf("%s          \n\n", lavg);
-		}
-
-		print_stat(&par[0], 0, verbose);
-		if(max_cycles && stat[0].cycles >= max_cycles)
+			print_ring();
+		} else if (verbose)
+			print_values(&ringstat, 0, VALBUF_SIZE - 1);
+		if(max_cycles && ringstat.cycles >= max_cycles)
+			allstopped++;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if (duration && ts2ns(&ts) >= stoptime)
 			allstopped++;
 
 		usleep(10000);
@@ -412,23 +679,44 @@ int main(int argc, char **argv)
  outall:
 	shutdown = 1;
 	usleep(50000);
-	if (quiet)
-		quiet = 2;
 	for (i = 0; i < num_threads; i++) {
 		if (stat[i].threadstarted > 0)
 			pthread_kill(stat[i].thread, SIGTERM);
-		if (stat[i].threadstarted) {
+		if (stat[i].threadstarted)
 			pthread_join(stat[i].thread, NULL);
-			if (quiet)
-				print_stat(&par[i], i, 0);
-		}
+	}
+	if (!verbose && !ret) {
+		for (i = 0; i < num_threads; i++)
+			print_hop(&par[i], &stat[(i + num_threads - 1) %
+				  num_threads], i);
+		print_ring();
+	}
+	if (histogram && !ret) {
+		struct rt_hist *hist[num_threads + 1];
+
+		for (i = 0; i < num_threads; i++)
+			hist[i] = stat[i].hist;
+		hist[i] = ringstat.hist;
+		rt_hist_print(hist, num_threads + 1, histogram);
+	}
+	for (i = 0; i < num_threads; i++) {
 		if (stat[i].values)
 			free(stat[i].values);
+		if (stat[i].hist)
+			free(stat[i].hist);
 	}
+	if (ringstat.values)
+		free(ringstat.values);
+	if (ringstat.hist)
+		free(ringstat.hist);
+	free(tokens);
+ outstat:
 	free(stat);
  outpar:
 	free(par);
  out:
+	if (trace_fd >= 0)
+		close(trace_fd);
 	if (lockall)
 		munlockall();
 
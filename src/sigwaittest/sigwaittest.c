@@ -38,6 +38,9 @@
 #include <utmpx.h>
 #include "rt-utils.h"
 #include "rt-get_cpu.h"
+#include "rt-shm.h"
+#include "rt-hist.h"
+#include "rt-signal.h"
 
 #include <pthread.h>
 
@@ -45,6 +48,8 @@
 
 #define USEC_PER_SEC 1000000
 
+#define SHM_NAME "/sigwaittest"
+
 enum {
 	AFFINITY_UNSPECIFIED,
 	AFFINITY_SPECIFIED,
@@ -53,7 +58,6 @@ enum {
 
 struct params {
 	int num;
-	int num_threads;
 	int cpu;
 	int priority;
 	int affinity;
@@ -61,6 +65,10 @@ struct params {
 	int samples;
 	int max_cycles;
 	int tracelimit;
+	int histogram;
+	int mode;
+	int queued;
+	int burst;
 	int tid;
 	pid_t pid;
 	int shutdown;
@@ -68,17 +76,76 @@ struct params {
 	struct timespec delay;
 	unsigned int mindiff, maxdiff;
 	double sumdiff;
-	struct timeval unblocked, received, diff;
+	long diff;
+	unsigned int lastmax;
+	double lastsum;
+	unsigned long bursts;
 	pthread_t threadid;
-	struct params *neighbor;
 	char error[MAX_PATH * 2];
-};
+} __attribute__((aligned(RT_SHM_CACHELINE)));
 
 static int mustfork;
 static int wasforked;
 static int wasforked_sender = -1;
 static int wasforked_threadno = -1;
 static int tracelimit;
+static struct rt_shm shm;
+
+static void update_latency(struct params *par, struct params *neighbor,
+			   struct rt_hist *hist)
+{
+	par->samples++;
+
+	if (par->diff < par->mindiff)
+		par->mindiff = par->diff;
+	if (par->diff > par->maxdiff)
+		par->maxdiff = par->diff;
+	par->sumdiff += (double) par->diff;
+	if (par->histogram)
+		rt_hist_add(hist, par->histogram, par->diff);
+	if (par->tracelimit && par->maxdiff > par->tracelimit) {
+		char tracing_enabled_file[MAX_PATH];
+
+		strcpy(tracing_enabled_file, get_debugfileprefix());
+		strcat(tracing_enabled_file, "tracing_enabled");
+		int tracing_enabled =
+		    open(tracing_enabled_file, O_WRONLY);
+		if (tracing_enabled >= 0) {
+			write(tracing_enabled, "0", 1);
+			close(tracing_enabled);
+		} else
+			snprintf(par->error, sizeof(par->error),
+			    "Could not access %s\n",
+			    tracing_enabled_file);
+		par->shutdown = 1;
+		neighbor->shutdown = 1;
+	}
+
+	if (par->max_cycles && par->samples >= par->max_cycles)
+		par->shutdown = 1;
+}
+
+/*
+ * Send the test signal to the receiver. With -s, it is a queued realtime
+ * signal that carries the time it was sent.
+ */
+static int send_signal(struct params *par, struct params *neighbor)
+{
+	union sigval value;
+
+	if (!par->queued) {
+		if (wasforked)
+			return kill(neighbor->pid, SIGUSR2);
+		errno = pthread_kill(neighbor->threadid, SIGUSR2);
+		return errno ? -1 : 0;
+	}
+
+	value.sival_ptr = (void *) (uintptr_t) rt_shm_gettime();
+	if (wasforked)
+		return sigqueue(neighbor->pid, SIGRTMIN, value);
+	errno = pthread_sigqueue(neighbor->threadid, SIGRTMIN, value);
+	return errno ? -1 : 0;
+}
 
 void *semathread(void *param)
 {
@@ -87,6 +154,13 @@ void *semathread(void *param)
 	cpu_set_t mask;
 	int policy = SCHED_FIFO;
 	struct sched_param schedp;
+	struct rt_shm_stamp *stamp = rt_shm_slot(&shm, RT_SHM_STAMP, par->num);
+	struct rt_hist *hist = rt_shm_slot(&shm, RT_SHM_HIST, par->num);
+	struct params *neighbor = rt_shm_slot(&shm,
+	    par->sender ? RT_SHM_RECEIVER : RT_SHM_SENDER, par->num);
+	struct rt_signal_waiter waiter;
+	sigset_t sigset;
+	int i, sig;
 
 	memset(&schedp, 0, sizeof(schedp));
 	schedp.sched_priority = par->priority;
@@ -110,30 +184,37 @@ void *semathread(void *param)
 	if (!wasforked)
 		par->tid = gettid();
 
-	while (!par->shutdown) {
-		int sig;
-		int first = 1;
-		sigset_t sigset;
-		struct params *neighbor = NULL;
+	sigemptyset(&sigset);
+	if (par->sender) {
+		sigaddset(&sigset, SIGUSR1);
+		pthread_sigmask(SIG_SETMASK, &sigset, NULL);
+	} else {
+		pthread_sigmask(SIG_SETMASK, &sigset, NULL);
+		if (rt_signal_init(&waiter, par->mode,
+		    par->queued ? SIGRTMIN : SIGUSR2)) {
+			snprintf(par->error, sizeof(par->error),
+			    "Could not set up %s: %s\n",
+			    rt_signal_mode_names[par->mode], strerror(errno));
+			par->shutdown = 1;
+			neighbor->shutdown = 1;
+		}
+	}
 
+	while (!par->shutdown) {
 		if (par->sender) {
-			if (wasforked)
-				neighbor = par - par->num_threads;
-			else
-				neighbor = par->neighbor;
-			if (first) {
-				sigemptyset(&sigset);
-				sigaddset(&sigset, SIGUSR1);
-				pthread_sigmask(SIG_SETMASK, &sigset, NULL);
-				first = 0;
-			}
-
 			/* Sending signal: Start of latency measurement ... */
-			gettimeofday(&par->unblocked, NULL);
-			if (wasforked)
-				kill(neighbor->pid, SIGUSR2);
-			else
-				pthread_kill(neighbor->threadid, SIGUSR2);
+			stamp->ns = rt_shm_gettime();
+			for (i = 0; i < par->burst; i++) {
+				if (send_signal(par, neighbor)) {
+					snprintf(par->error, sizeof(par->error),
+					    "Could not send signal: %s\n",
+					    strerror(errno));
+					par->shutdown = 1;
+					break;
+				}
+			}
+			if (par->shutdown)
+				continue;
 			par->samples++;
 			if(par->max_cycles && par->samples >= par->max_cycles)
 				par->shutdown = 1;
@@ -144,55 +225,51 @@ void *semathread(void *param)
 			sigwait(&sigset, &sig);
 		} else {
 			/* Receiver */
-			if (wasforked)
-				neighbor = par + par->num_threads;
-			else
-				neighbor = par->neighbor;
-			if (first) {
-				sigemptyset(&sigset);
-				sigaddset(&sigset, SIGUSR2);
-				pthread_sigmask(SIG_SETMASK, &sigset, NULL);
-				first = 0;
-			}
-			sigwait(&sigset, &sig);
+			for (i = 0; i < par->burst && !par->shutdown; ) {
+				uintptr_t payload;
+				uint64_t now;
 
-			/* ... Signal received: End of latency measurement */
-			gettimeofday(&par->received, NULL);
-			par->samples++;
-			if (par->max_cycles && par->samples >= par->max_cycles)
-				par->shutdown = 1;
-
-			if (mustgetcpu) {
-				par->cpu = get_cpu();
-		        }
-			/*
-			 * Latency is the time spent between sending and
-			 * receiving the signal.
-			 */
-			timersub(&par->received, &neighbor->unblocked,
-			    &par->diff);
-
-			if (par->diff.tv_usec < par->mindiff)
-				par->mindiff = par->diff.tv_usec;
-			if (par->diff.tv_usec > par->maxdiff)
-				par->maxdiff = par->diff.tv_usec;
-			par->sumdiff += (double) par->diff.tv_usec;
-			if (par->tracelimit && par->maxdiff > par->tracelimit) {
-				char tracing_enabled_file[MAX_PATH];
-
-				strcpy(tracing_enabled_file, get_debugfileprefix());
-				strcat(tracing_enabled_file, "tracing_enabled");
-				int tracing_enabled =
-				    open(tracing_enabled_file, O_WRONLY);
-				if (tracing_enabled >= 0) {
-					write(tracing_enabled, "0", 1);
-					close(tracing_enabled);
-				} else
+				sig = rt_signal_wait(&waiter, &payload);
+				if (sig < 0) {
 					snprintf(par->error, sizeof(par->error),
-					    "Could not access %s\n",
-					    tracing_enabled_file);
-				par->shutdown = 1;
-				neighbor->shutdown = 1;
+					    "%s failed: %s\n",
+					    rt_signal_mode_names[par->mode],
+					    strerror(errno));
+					par->shutdown = 1;
+					break;
+				}
+				if (sig == 0)
+					continue;
+
+				/*
+				 * ... Signal received: End of latency
+				 * measurement. Latency is the time spent
+				 * between sending and receiving the signal.
+				 * A queued signal tells when it was sent,
+				 * unless sigwait() drops its payload, then
+				 * it is the time the burst was started.
+				 */
+				now = rt_shm_gettime();
+				if (par->queued &&
+				    par->mode != RT_SIGNAL_SIGWAIT)
+					par->diff = ((uintptr_t) now - payload)
+					    / 1000;
+				else
+					par->diff = (now - stamp->ns) / 1000;
+				update_latency(par, neighbor, hist);
+				i++;
+
+				if (mustgetcpu) {
+					par->cpu = get_cpu();
+				}
+			}
+
+			/* The last signal of a burst waited for all others */
+			if (par->burst > 1 && i == par->burst) {
+				if (par->diff > par->lastmax)
+					par->lastmax = par->diff;
+				par->lastsum += (double) par->diff;
+				par->bursts++;
 			}
 
 			nanosleep(&par->delay, NULL);
@@ -203,6 +280,8 @@ void *semathread(void *param)
 				pthread_kill(neighbor->threadid, SIGUSR1);
 		}
 	}
+	if (!par->sender)
+		rt_signal_cleanup(&waiter);
 	par->stopped = 1;
 	return NULL;
 }
@@ -218,15 +297,28 @@ static void display_help(void)
 	"-a [NUM] --affinity        run thread #N on processor #N, if possible\n"
 	"                           with NUM pin all threads to the processor NUM\n"
 	"-b USEC  --breaktrace=USEC send break trace command when latency > USEC\n"
+	"-B NUM   --burst=NUM       queue NUM signals per cycle, requires -s\n"
 	"-d DIST  --distance=DIST   distance of thread intervals in us default=500\n"
+	"-D       --duration=t      specify a length for the test run\n"
+	"                           default is in seconds, but 'm', 'h', or 'd' maybe added\n"
+	"                           to modify value to minutes, hours or days\n"
 	"-f       --fork            fork new processes instead of creating threads\n"
+	"-h       --histogram=US    dump a latency histogram to stdout after the run\n"
+	"                           US is the max time to be tracked in microseconds\n"
 	"-i INTV  --interval=INTV   base interval of thread in us default=1000\n"
 	"-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
 	"-p PRIO  --prio=PRIO       priority\n"
+	"-q       --quiet           print only a summary on exit\n"
+	"-s       --sigqueue        send a queued realtime signal with sigqueue()\n"
+	"                           that carries the time it was sent\n"
 	"-t       --threads         one thread per available processor\n"
 	"-t [NUM] --threads=NUM     number of threads:\n"
 	"                           without NUM, threads = max_cpus\n"
-	"                           without -t default = 1\n");
+	"                           without -t default = 1\n"
+	"-w LIST  --wait=LIST       comma separated list of receive modes, every\n"
+	"                           mode gets its own threads: sigwait,\n"
+	"                           sigwaitinfo, sigtimedwait, signalfd\n"
+	"                           default=sigwait\n");
 	exit(1);
 }
 
@@ -238,6 +330,36 @@ static int num_threads = 1;
 static int max_cycles;
 static int interval = 1000;
 static int distance = 500;
+static int histogram;
+static int quiet;
+static int duration;
+static int queued;
+static int burst = 1;
+static int use_mode[RT_SIGNAL_NUM_MODES];
+static int num_modes;
+
+static int parse_modes(char *list)
+{
+	char *name, *saveptr = NULL;
+	int mode;
+
+	num_modes = 0;
+	for (name = strtok_r(list, ",", &saveptr); name != NULL;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		mode = rt_signal_parse_mode(name);
+		if (mode < 0) {
+			fprintf(stderr, "ERROR: unknown receive mode %s\n",
+			    name);
+			return -1;
+		}
+		if (num_modes == RT_SIGNAL_NUM_MODES) {
+			fprintf(stderr, "ERROR: too many receive modes\n");
+			return -1;
+		}
+		use_mode[num_modes++] = mode;
+	}
+	return num_modes ? 0 : -1;
+}
 
 static void process_options (int argc, char *argv[])
 {
@@ -251,16 +373,22 @@ static void process_options (int argc, char *argv[])
 		static struct option long_options[] = {
 			{"affinity", optional_argument, NULL, 'a'},
 			{"breaktrace", required_argument, NULL, 'b'},
+			{"burst", required_argument, NULL, 'B'},
 			{"distance", required_argument, NULL, 'd'},
+			{"duration", required_argument, NULL, 'D'},
 			{"fork", optional_argument, NULL, 'f'},
+			{"histogram", required_argument, NULL, 'h'},
 			{"interval", required_argument, NULL, 'i'},
 			{"loops", required_argument, NULL, 'l'},
 			{"priority", required_argument, NULL, 'p'},
+			{"quiet", no_argument, NULL, 'q'},
+			{"sigqueue", no_argument, NULL, 's'},
 			{"threads", optional_argument, NULL, 't'},
+			{"wait", required_argument, NULL, 'w'},
 			{"help", no_argument, NULL, '?'},
 			{NULL, 0, NULL, 0}
 		};
-		int c = getopt_long (argc, argv, "a::b:d:f::i:l:p:t::",
+		int c = getopt_long (argc, argv, "a::b:B:d:D:f::h:i:l:p:qst::w:",
 			long_options, &option_index);
 		if (c == -1)
 			break;
@@ -277,7 +405,9 @@ static void process_options (int argc, char *argv[])
 			}
 			break;
 		case 'b': thistracelimit = atoi(optarg); break;
+		case 'B': burst = atoi(optarg); break;
 		case 'd': distance = atoi(optarg); break;
+		case 'D': duration = parse_time_string(optarg); break;
 		case 'f':
 			if (optarg != NULL) {
 				wasforked = 1;
@@ -289,9 +419,12 @@ static void process_options (int argc, char *argv[])
 			} else
 				mustfork = 1;
 			break;
+		case 'h': histogram = atoi(optarg); break;
 		case 'i': interval = atoi(optarg); break;
 		case 'l': max_cycles = atoi(optarg); break;
 		case 'p': priority = atoi(optarg); break;
+		case 'q': quiet = 1; break;
+		case 's': queued = 1; break;
 		case 't':
 			if (optarg != NULL)
 				num_threads = atoi(optarg);
@@ -300,6 +433,10 @@ static void process_options (int argc, char *argv[])
 			else
 				num_threads = max_cpus;
 			break;
+		case 'w':
+			if (parse_modes(optarg))
+				error = 1;
+			break;
 		case '?': error = 1; break;
 		}
 	}
@@ -322,6 +459,24 @@ static void process_options (int argc, char *argv[])
 		if (priority < 0 || priority > 99)
 			error = 1;
 
+		if (histogram < 0)
+			error = 1;
+
+		if (histogram > RT_HIST_MAX)
+			histogram = RT_HIST_MAX;
+
+		if (duration < 0)
+			error = 1;
+
+		if (burst < 1)
+			error = 1;
+
+		/* Standard signals do not queue, a burst would get lost */
+		if (burst > 1 && !queued) {
+			fprintf(stderr, "ERROR: -B requires -s\n");
+			error = 1;
+		}
+
 		tracelimit = thistracelimit;
 	}
 	if (error)
@@ -339,17 +494,19 @@ static void sighand(int sig)
 
 int main(int argc, char *argv[])
 {
-	int i, totalsize = 0;
+	int i, num_pairs, startprio, startinterval;
 	int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
 	int oldsamples = 1;
 	struct params *receiver = NULL;
 	struct params *sender = NULL;
 	sigset_t sigset;
-	void *param = NULL;
 	char f_opt[8];
 	struct timespec launchdelay, maindelay;
+	uint64_t stoptime;
 
 	process_options(argc, argv);
+	startprio = priority;
+	startinterval = interval;
 
 	if (check_privs())
 		return 1;
@@ -361,99 +518,72 @@ int main(int argc, char *argv[])
 
 	get_cpu_setup();	/* init get_cpu() */
 
-	if (mustfork) {
-		int shmem;
-
-		/*
-		 * In fork mode (-f), the shared memory contains two
-		 * subsequent arrays, receiver[num_threads] and
-		 * sender[num_threads].
-		 */
-		totalsize = num_threads * sizeof(struct params) * 2;
-
-		shm_unlink("/sigwaittest");
-  		shmem = shm_open("/sigwaittest", O_CREAT|O_EXCL|O_RDWR,
-		    S_IRUSR|S_IWUSR);
-		if (shmem < 0) {
-			fprintf(stderr, "Could not create shared memory\n");
-			return 1;
-		}
-		ftruncate(shmem, totalsize);
-		param = mmap(0, totalsize, PROT_READ|PROT_WRITE, MAP_SHARED,
-		    shmem, 0);
-		if (param == MAP_FAILED) {
-			fprintf(stderr, "Could not map shared memory\n");
-			close(shmem);
-			return 1;
-		}
-
-		receiver = (struct params *) param;
-		sender = receiver + num_threads;
-	} else if (wasforked) {
-		struct stat buf;
-		int shmem, totalsize, expect_totalsize;
+	if (wasforked) {
+		struct params *par;
 
 		if (wasforked_threadno == -1 || wasforked_sender == -1) {
 			fprintf(stderr, "Invalid fork option\n");
 			return 1;
 		}
-		shmem = shm_open("/sigwaittest", O_RDWR, S_IRUSR|S_IWUSR);
-		if (fstat(shmem, &buf)) {
-			fprintf(stderr,
-			    "Could not determine shared memory size\n");
-			close(shmem);
-			return 1;
-		}
-		totalsize = buf.st_size;
-		param = mmap(0, totalsize, PROT_READ|PROT_WRITE, MAP_SHARED,
-		    shmem, 0);
-		close(shmem);
-		if (param == MAP_FAILED) {
-			fprintf(stderr, "Could not map shared memory\n");
+		if (rt_shm_attach(&shm, SHM_NAME, sizeof(struct params), 0)) {
+			fprintf(stderr, "Could not attach shared memory: %s\n",
+			    errno == EPROTO ? "layout mismatch" :
+			    strerror(errno));
 			return 1;
 		}
-
-		receiver = (struct params *) param;
-		expect_totalsize = receiver->num_threads *
-		    sizeof(struct params) * 2;
-		if (totalsize != expect_totalsize) {
-			fprintf(stderr, "Memory size problem (expected %d, "
-			    "found %d\n", expect_totalsize, totalsize);
-			munmap(param, totalsize);
+		if (wasforked_threadno >= rt_shm_num_pairs(&shm)) {
+			fprintf(stderr, "Invalid fork option\n");
+			rt_shm_detach(&shm);
 			return 1;
 		}
-		sender = receiver + receiver->num_threads;
-		if (wasforked_sender)
-			semathread(sender + wasforked_threadno);
-		else
-			semathread(receiver + wasforked_threadno);
-		munmap(param, totalsize);
+		par = rt_shm_slot(&shm, wasforked_sender ? RT_SHM_SENDER :
+		    RT_SHM_RECEIVER, wasforked_threadno);
+		semathread(par);
+		rt_shm_detach(&shm);
 		return 0;
 	}
 
+	/*
+	 * The params of all threads are in shared memory, see rt-shm.h.
+	 * In fork mode (-f), it is a named region that the children
+	 * attach to.
+	 */
+	num_pairs = num_threads * (num_modes ? num_modes : 1);
+	if (rt_shm_create(&shm, mustfork ? SHM_NAME : NULL, num_pairs,
+	    sizeof(struct params), histogram ? rt_hist_size(histogram) : 0,
+	    0)) {
+		fprintf(stderr, "Could not create shared memory: %s\n",
+		    strerror(errno));
+		return 1;
+	}
+	receiver = rt_shm_slot(&shm, RT_SHM_RECEIVER, 0);
+	sender = rt_shm_slot(&shm, RT_SHM_SENDER, 0);
+
 	signal(SIGINT, sighand);
 	signal(SIGTERM, sighand);
 	sigemptyset(&sigset);
 	pthread_sigmask(SIG_SETMASK, &sigset, NULL);
 
-	if (!mustfork && !wasforked) {
-		receiver = calloc(num_threads, sizeof(struct params));
-		sender = calloc(num_threads, sizeof(struct params));
-		if (receiver == NULL || sender == NULL)
-			goto nomem;
-	}
-
 	launchdelay.tv_sec = 0;
 	launchdelay.tv_nsec = 10000000; /* 10 ms */
 
-	maindelay.tv_sec = 0;
-	maindelay.tv_nsec = 50000000; /* 50 ms */
+	rt_shm_maindelay(&maindelay, quiet);
 
-	for (i = 0; i < num_threads; i++) {
+	for (i = 0; i < num_pairs; i++) {
 		receiver[i].mindiff = UINT_MAX;
 		receiver[i].maxdiff = 0;
 		receiver[i].sumdiff = 0.0;
 
+		/* Every receive mode starts with the same priority and interval */
+		if (i % num_threads == 0) {
+			priority = startprio;
+			interval = startinterval;
+		}
+		receiver[i].mode = num_modes ? use_mode[i / num_threads] :
+		    RT_SIGNAL_SIGWAIT;
+		receiver[i].queued = queued;
+		receiver[i].burst = burst;
+
 		receiver[i].num = i;
 		receiver[i].cpu = i;
 		receiver[i].priority = priority;
@@ -468,9 +598,9 @@ int main(int argc, char *argv[])
 		receiver[i].delay.tv_sec = interval / USEC_PER_SEC;
 		receiver[i].delay.tv_nsec = (interval % USEC_PER_SEC) * 1000;
 		interval += distance;
-		receiver[i].max_cycles = max_cycles;
+		receiver[i].max_cycles = max_cycles * burst;
+		receiver[i].histogram = histogram;
 		receiver[i].sender = 0;
-		receiver[i].neighbor = &sender[i];
 		if (mustfork) {
 			pid_t pid = fork();
 			if (pid == -1) {
@@ -479,7 +609,6 @@ int main(int argc, char *argv[])
 			} else if (pid == 0) {
 				char *args[3];
 
-				receiver[i].num_threads = num_threads;
 				receiver[i].pid = getpid();
 				sprintf(f_opt, "-fr%d", i);
 				args[0] = argv[0];
@@ -498,7 +627,7 @@ int main(int argc, char *argv[])
 
 		memcpy(&sender[i], &receiver[i], sizeof(receiver[0]));
 		sender[i].sender = 1;
-		sender[i].neighbor = &receiver[i];
+		sender[i].max_cycles = max_cycles;
 		if (mustfork) {
 			pid_t pid = fork();
 			if (pid == -1) {
@@ -507,7 +636,6 @@ int main(int argc, char *argv[])
 			} else if (pid == 0) {
 				char *args[3];
 
-				sender[i].num_threads = num_threads;
 				sender[i].pid = getpid();
 				sprintf(f_opt, "-fs%d", i);
 				args[0] = argv[0];
@@ -523,16 +651,19 @@ int main(int argc, char *argv[])
 			    &sender[i]);
 	}
 
+	stoptime = rt_shm_gettime() + duration * 1000000000ULL;
 	while (!mustshutdown) {
 		int printed;
 		int errorlines = 0;
 
-		for (i = 0; i < num_threads; i++)
+		for (i = 0; i < num_pairs; i++)
 			mustshutdown |= receiver[i].shutdown |
 			    sender[i].shutdown;
+		if (duration && rt_shm_gettime() >= stoptime)
+			mustshutdown = 1;
 
-		if (receiver[0].samples > oldsamples || mustshutdown) {
-			for (i = 0; i < num_threads; i++) {
+		if ((!quiet && receiver[0].samples > oldsamples) || mustshutdown) {
+			for (i = 0; i < num_pairs; i++) {
 				int receiver_pid, sender_pid;
 				if (mustfork) {
 					receiver_pid = receiver[i].pid;
@@ -548,18 +679,31 @@ int main(int argc, char *argv[])
 				    1000, i*2+1, sender_pid, sender[i].priority,
 				    sender[i].cpu, sender[i].samples);
 			}
-			for (i = 0; i < num_threads; i++) {
-				if (receiver[i].mindiff == -1)
-					printf("#%d -> #%d (not yet ready)\n",
-					    i*2+1, i*2);
+			for (i = 0; i < num_pairs; i++) {
+				if (num_modes)
+					printf("#%d -> #%d, %-12s ", i*2+1, i*2,
+					    rt_signal_mode_names[receiver[i].mode]);
+				else
+					printf("#%d -> #%d, ", i*2+1, i*2);
+				if (receiver[i].samples == 0)
+					printf("(not yet ready)");
 				else
-					printf("#%d -> #%d, Min %4d, Cur %4d, "
-					    "Avg %4d, Max %4d\n",
-					    i*2+1, i*2,	receiver[i].mindiff,
-					    (int) receiver[i].diff.tv_usec,
+					printf("Min %4d, Cur %4d, Avg %4d, "
+					    "Max %4d", receiver[i].mindiff,
+					    (int) receiver[i].diff,
 					    (int) ((receiver[i].sumdiff /
 					    receiver[i].samples) + 0.5),
 					    receiver[i].maxdiff);
+				/*
+				 * The last signal of a burst shows how long
+				 * the queue took to drain.
+				 */
+				if (burst > 1 && receiver[i].bursts)
+					printf(", Last Avg %4d, Max %4d",
+					    (int) ((receiver[i].lastsum /
+					    receiver[i].bursts) + 0.5),
+					    receiver[i].lastmax);
+				printf("\n");
 				if (receiver[i].error[0] != '\0') {
 					printf(receiver[i].error);
 					receiver[i].error[0] = '\0';
@@ -586,16 +730,16 @@ int main(int argc, char *argv[])
 		pthread_sigmask(SIG_SETMASK, &sigset, NULL);
 
 		if (printed && !mustshutdown)
-			printf("\033[%dA", num_threads*2 + errorlines);
+			printf("\033[%dA", num_pairs*2 + errorlines);
 	}
 
-	for (i = 0; i < num_threads; i++) {
+	for (i = 0; i < num_pairs; i++) {
 		receiver[i].shutdown = 1;
 		sender[i].shutdown = 1;
 	}
 	nanosleep(&receiver[0].delay, NULL);
 
-	for (i = 0; i < num_threads; i++) {
+	for (i = 0; i < num_pairs; i++) {
 		if (!receiver[i].stopped) {
 			if (mustfork)
 				kill(receiver[i].pid, SIGTERM);
@@ -610,11 +754,15 @@ int main(int argc, char *argv[])
 		}
 	}
 
- 	nomem:
-	if (mustfork) {
-		munmap(param, totalsize);
-		shm_unlink("/sigwaittest");
+	if (histogram) {
+		struct rt_hist *hist[num_pairs];
+
+		for (i = 0; i < num_pairs; i++)
+			hist[i] = rt_shm_slot(&shm, RT_SHM_HIST, i);
+		rt_hist_print(hist, num_pairs, histogram);
 	}
 
+	rt_shm_destroy(&shm);
+
 	return 0;
 }
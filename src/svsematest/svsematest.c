@@ -20,6 +20,7 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -42,12 +43,16 @@
 #include <sys/mman.h>
 #include "rt-utils.h"
 #include "rt-get_cpu.h"
+#include "rt-shm.h"
+#include "rt-hist.h"
 #include "error.h"
 
 #define gettid() syscall(__NR_gettid)
 
 #define USEC_PER_SEC 1000000
 
+#define SHM_NAME "/svsematest"
+
 #define SEM_WAIT_FOR_RECEIVER 0
 #define SEM_WAIT_FOR_SENDER 1
 
@@ -62,7 +67,6 @@ enum {
 
 struct params {
 	int num;
-	int num_threads;
 	int cpu;
 	int priority;
 	int affinity;
@@ -71,6 +75,7 @@ struct params {
 	int samples;
 	int max_cycles;
 	int tracelimit;
+	int histogram;
 	int tid;
 	pid_t pid;
 	int shutdown;
@@ -78,17 +83,17 @@ struct params {
 	struct timespec delay;
 	unsigned int mindiff, maxdiff;
 	double sumdiff;
-	struct timeval unblocked, received, diff;
+	long diff;
 	pthread_t threadid;
-	struct params *neighbor;
 	char error[MAX_PATH * 2];
-};
+} __attribute__((aligned(RT_SHM_CACHELINE)));
 
 static int mustfork;
 static int wasforked;
 static int wasforked_sender = -1;
 static int wasforked_threadno = -1;
 static int tracelimit;
+static struct rt_shm shm;
 
 void *semathread(void *param)
 {
@@ -99,6 +104,10 @@ void *semathread(void *param)
 	struct sched_param schedp;
 	struct sembuf sb = { 0, 0, 0};
 	sigset_t sigset;
+	struct rt_shm_stamp *stamp = rt_shm_slot(&shm, RT_SHM_STAMP, par->num);
+	struct rt_hist *hist = rt_shm_slot(&shm, RT_SHM_HIST, par->num);
+	struct params *neighbor = rt_shm_slot(&shm,
+	    par->sender ? RT_SHM_RECEIVER : RT_SHM_SENDER, par->num);
 
 	sigemptyset(&sigset);
 	pthread_sigmask(SIG_SETMASK, &sigset, NULL);
@@ -134,7 +143,7 @@ void *semathread(void *param)
 			 * Unlocking the semaphore:
 			 *   Start of latency measurement ...
 			 */
-			gettimeofday(&par->unblocked, NULL);
+			stamp->ns = rt_shm_gettime();
 			semop(par->semid, &sb, 1);
 			par->samples++;
 			if(par->max_cycles && par->samples >= par->max_cycles)
@@ -152,13 +161,6 @@ void *semathread(void *param)
 			semop(par->semid, &sb, 1);
 		} else {
 			/* Receiver */
-			struct params *neighbor;
-
- 			if (wasforked)
-				neighbor = par + par->num_threads;
-			else
-				neighbor = par->neighbor;
-
  			sb.sem_num = SEM_WAIT_FOR_SENDER;
 			sb.sem_op = SEM_LOCK;
 			semop(par->semid, &sb, 1);
@@ -167,7 +169,7 @@ void *semathread(void *param)
 			 * ... We got the lock:
 			 * End of latency measurement
 			 */
-			gettimeofday(&par->received, NULL);
+			par->diff = (rt_shm_gettime() - stamp->ns) / 1000;
 			par->samples++;
 			if (par->max_cycles && par->samples >= par->max_cycles)
 				par->shutdown = 1;
@@ -175,14 +177,13 @@ void *semathread(void *param)
 			if (mustgetcpu)
 				par->cpu = get_cpu();
 
-			timersub(&par->received, &neighbor->unblocked,
-			    &par->diff);
-
-			if (par->diff.tv_usec < par->mindiff)
-				par->mindiff = par->diff.tv_usec;
-			if (par->diff.tv_usec > par->maxdiff)
-				par->maxdiff = par->diff.tv_usec;
-			par->sumdiff += (double) par->diff.tv_usec;
+			if (par->diff < par->mindiff)
+				par->mindiff = par->diff;
+			if (par->diff > par->maxdiff)
+				par->maxdiff = par->diff;
+			par->sumdiff += (double) par->diff;
+			if (par->histogram)
+				rt_hist_add(hist, par->histogram, par->diff);
 			if (par->tracelimit && par->maxdiff > par->tracelimit) {
 				char tracing_enabled_file[MAX_PATH];
 
@@ -245,10 +246,16 @@ static void display_help(void)
 	"                           with NUM pin all threads to the processor NUM\n"
 	"-b USEC  --breaktrace=USEC send break trace command when latency > USEC\n"
 	"-d DIST  --distance=DIST   distance of thread intervals in us default=500\n"
+	"-D       --duration=t      specify a length for the test run\n"
+	"                           default is in seconds, but 'm', 'h', or 'd' maybe added\n"
+	"                           to modify value to minutes, hours or days\n"
 	"-f       --fork            fork new processes instead of creating threads\n"
+	"-h       --histogram=US    dump a latency histogram to stdout after the run\n"
+	"                           US is the max time to be tracked in microseconds\n"
 	"-i INTV  --interval=INTV   base interval of thread in us default=1000\n"
 	"-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
 	"-p PRIO  --prio=PRIO       priority\n"
+	"-q       --quiet           print only a summary on exit\n"
 	"-S       --smp             SMP testing: options -a -t and same priority\n"
         "                           of all threads\n"
 	"-t       --threads         one thread per available processor\n"
@@ -266,6 +273,9 @@ static int num_threads = 1;
 static int max_cycles;
 static int interval = 1000;
 static int distance = 500;
+static int histogram;
+static int quiet;
+static int duration;
 static int smp;
 static int sameprio;
 
@@ -282,16 +292,19 @@ static void process_options (int argc, char *argv[])
 			{"affinity", optional_argument, NULL, 'a'},
 			{"breaktrace", required_argument, NULL, 'b'},
 			{"distance", required_argument, NULL, 'd'},
+			{"duration", required_argument, NULL, 'D'},
 			{"fork", optional_argument, NULL, 'f'},
+			{"histogram", required_argument, NULL, 'h'},
 			{"interval", required_argument, NULL, 'i'},
 			{"loops", required_argument, NULL, 'l'},
 			{"priority", required_argument, NULL, 'p'},
+			{"quiet", no_argument, NULL, 'q'},
 			{"smp", no_argument, NULL, 'S'},
 			{"threads", optional_argument, NULL, 't'},
 			{"help", no_argument, NULL, '?'},
 			{NULL, 0, NULL, 0}
 		};
-		int c = getopt_long (argc, argv, "a::b:d:f::i:l:p:St::",
+		int c = getopt_long (argc, argv, "a::b:d:D:f::h:i:l:p:qSt::",
 			long_options, &option_index);
 		if (c == -1)
 			break;
@@ -313,6 +326,7 @@ static void process_options (int argc, char *argv[])
 			break;
 		case 'b': thistracelimit = atoi(optarg); break;
 		case 'd': distance = atoi(optarg); break;
+		case 'D': duration = parse_time_string(optarg); break;
 		case 'f':
 			if (optarg != NULL) {
 				wasforked = 1;
@@ -324,9 +338,11 @@ static void process_options (int argc, char *argv[])
 			} else
 				mustfork = 1;
 			break;
+		case 'h': histogram = atoi(optarg); break;
 		case 'i': interval = atoi(optarg); break;
 		case 'l': max_cycles = atoi(optarg); break;
 		case 'p': priority = atoi(optarg); break;
+		case 'q': quiet = 1; break;
 		case 'S':
 			smp = 1;
 			num_threads = max_cpus;
@@ -366,6 +382,15 @@ static void process_options (int argc, char *argv[])
 		if (priority < 0 || priority > 99)
 			error = 1;
 
+		if (histogram < 0)
+			error = 1;
+
+		if (histogram > RT_HIST_MAX)
+			histogram = RT_HIST_MAX;
+
+		if (duration < 0)
+			error = 1;
+
 		if (priority && smp)
 			sameprio = 1;
 
@@ -386,7 +411,7 @@ static void sighand(int sig)
 int main(int argc, char *argv[])
 {
 	char *myfile;
-	int i, totalsize = 0;
+	int i;
 	int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
 	int oldsamples = 1;
 	key_t key;
@@ -394,9 +419,9 @@ int main(int argc, char *argv[])
 	struct params *receiver = NULL;
 	struct params *sender = NULL;
 	sigset_t sigset;
-	void *param = NULL;
 	char f_opt[8];
 	struct timespec launchdelay, maindelay;
+	uint64_t stoptime;
 
 	myfile = getenv("_");
 	if (myfile == NULL)
@@ -414,94 +439,56 @@ int main(int argc, char *argv[])
 
 	get_cpu_setup();
 
-	if (mustfork) {
-		int shmem;
-
-		/*
-		 * In fork mode (-f), the shared memory contains two
-		 * subsequent arrays, receiver[num_threads] and
-		 * sender[num_threads].
-		 */
-		totalsize = num_threads * sizeof(struct params) * 2;
-
-		shm_unlink("/sigwaittest");
-  		shmem = shm_open("/sigwaittest", O_CREAT|O_EXCL|O_RDWR,
-		    S_IRUSR|S_IWUSR);
-		if (shmem < 0) {
-			fprintf(stderr, "Could not create shared memory\n");
-			return 1;
-		}
-		ftruncate(shmem, totalsize);
-		param = mmap(0, totalsize, PROT_READ|PROT_WRITE, MAP_SHARED,
-		    shmem, 0);
-		if (param == MAP_FAILED) {
-			fprintf(stderr, "Could not map shared memory\n");
-			close(shmem);
-			return 1;
-		}
-
-		receiver = (struct params *) param;
-		sender = receiver + num_threads;
-	} else if (wasforked) {
-		struct stat buf;
-		int shmem, totalsize, expect_totalsize;
+	if (wasforked) {
+		struct params *par;
 
 		if (wasforked_threadno == -1 || wasforked_sender == -1) {
 			fprintf(stderr, "Invalid fork option\n");
 			return 1;
 		}
-		shmem = shm_open("/sigwaittest", O_RDWR, S_IRUSR|S_IWUSR);
-		if (fstat(shmem, &buf)) {
-			fprintf(stderr,
-			    "Could not determine shared memory size\n");
-			close(shmem);
-			return 1;
-		}
-		totalsize = buf.st_size;
-		param = mmap(0, totalsize, PROT_READ|PROT_WRITE, MAP_SHARED,
-		    shmem, 0);
-		close(shmem);
-		if (param == MAP_FAILED) {
-			fprintf(stderr, "Could not map shared memory\n");
+		if (rt_shm_attach(&shm, SHM_NAME, sizeof(struct params), 0)) {
+			fprintf(stderr, "Could not attach shared memory: %s\n",
+			    errno == EPROTO ? "layout mismatch" :
+			    strerror(errno));
 			return 1;
 		}
-
-		receiver = (struct params *) param;
-		expect_totalsize = receiver->num_threads *
-		    sizeof(struct params) * 2;
-		if (totalsize != expect_totalsize) {
-			fprintf(stderr, "Memory size problem (expected %d, "
-			    "found %d\n", expect_totalsize, totalsize);
-			munmap(param, totalsize);
+		if (wasforked_threadno >= rt_shm_num_pairs(&shm)) {
+			fprintf(stderr, "Invalid fork option\n");
+			rt_shm_detach(&shm);
 			return 1;
 		}
-		sender = receiver + receiver->num_threads;
-		if (wasforked_sender)
-			semathread(sender + wasforked_threadno);
-		else
-			semathread(receiver + wasforked_threadno);
-		munmap(param, totalsize);
+		par = rt_shm_slot(&shm, wasforked_sender ? RT_SHM_SENDER :
+		    RT_SHM_RECEIVER, wasforked_threadno);
+		semathread(par);
+		rt_shm_detach(&shm);
 		return 0;
 	}
 
+	/*
+	 * The params of all threads are in shared memory, see rt-shm.h.
+	 * In fork mode (-f), it is a named region that the children
+	 * attach to.
+	 */
+	if (rt_shm_create(&shm, mustfork ? SHM_NAME : NULL, num_threads,
+	    sizeof(struct params), histogram ? rt_hist_size(histogram) : 0,
+	    0)) {
+		fprintf(stderr, "Could not create shared memory: %s\n",
+		    strerror(errno));
+		return 1;
+	}
+	receiver = rt_shm_slot(&shm, RT_SHM_RECEIVER, 0);
+	sender = rt_shm_slot(&shm, RT_SHM_SENDER, 0);
+
 	signal(SIGINT, sighand);
 	signal(SIGTERM, sighand);
 
 	sigemptyset(&sigset);
 	pthread_sigmask(SIG_SETMASK, &sigset, NULL);
 
-	if (!mustfork && !wasforked) {
-		receiver = calloc(num_threads, sizeof(struct params));
-		sender = calloc(num_threads, sizeof(struct params));
-		if (receiver == NULL || sender == NULL)
-			goto nomem;
-	}
-
 	launchdelay.tv_sec = 0;
 	launchdelay.tv_nsec = 10000000; /* 10 ms */
 
-	maindelay.tv_sec = 0;
-	maindelay.tv_nsec = 50000000; /* 50 ms */
+	rt_shm_maindelay(&maindelay, quiet);
 
 	for (i = 0; i < num_threads; i++) {
 		struct sembuf sb = { 0, 0, 0};
@@ -539,6 +526,7 @@ int main(int argc, char *argv[])
 		sb.sem_op = SEM_LOCK;
 		semop(receiver[i].semid, &sb, 1);
 
+		receiver[i].num = i;
 		receiver[i].cpu = i;
 		switch (setaffinity) {
 		case AFFINITY_UNSPECIFIED: receiver[i].cpu = -1; break;
@@ -553,8 +541,8 @@ int main(int argc, char *argv[])
 		receiver[i].delay.tv_nsec = (interval % USEC_PER_SEC) * 1000;
 		interval += distance;
 		receiver[i].max_cycles = max_cycles;
+		receiver[i].histogram = histogram;
 		receiver[i].sender = 0;
-		receiver[i].neighbor = &sender[i];
 		if (mustfork) {
 			pid_t pid = fork();
 			if (pid == -1) {
@@ -563,7 +551,6 @@ int main(int argc, char *argv[])
 			} else if (pid == 0) {
 				char *args[3];
 
-				receiver[i].num_threads = num_threads;
 				receiver[i].pid = getpid();
 				sprintf(f_opt, "-fr%d", i);
 				args[0] = argv[0];
@@ -582,7 +569,6 @@ int main(int argc, char *argv[])
 
 		memcpy(&sender[i], &receiver[i], sizeof(receiver[0]));
 		sender[i].sender = 1;
-		sender[i].neighbor = &receiver[i];
 		if (mustfork) {
 			pid_t pid = fork();
 			if (pid == -1) {
@@ -591,7 +577,6 @@ int main(int argc, char *argv[])
 			} else if (pid == 0) {
 				char *args[3];
 
-				sender[i].num_threads = num_threads;
 				sender[i].pid = getpid();
 				sprintf(f_opt, "-fs%d", i);
 				args[0] = argv[0];
@@ -607,6 +592,7 @@ int main(int argc, char *argv[])
 			    &sender[i]);
 	}
 
+	stoptime = rt_shm_gettime() + duration * 1000000000ULL;
 	while (!mustshutdown) {
 		int printed;
 		int errorlines = 0;
@@ -614,8 +600,10 @@ int main(int argc, char *argv[])
 		for (i = 0; i < num_threads; i++)
 			mustshutdown |= receiver[i].shutdown |
 			    sender[i].shutdown;
+		if (duration && rt_shm_gettime() >= stoptime)
+			mustshutdown = 1;
 
-		if (receiver[0].samples > oldsamples || mustshutdown) {
+		if ((!quiet && receiver[0].samples > oldsamples) || mustshutdown) {
 			for (i = 0; i < num_threads; i++) {
 				int receiver_pid, sender_pid;
 
@@ -641,7 +629,7 @@ int main(int argc, char *argv[])
 					printf("#%d -> #%d, Min %4d, Cur %4d, "
 					    "Avg %4d, Max %4d\n",
 					    i*2+1, i*2, receiver[i].mindiff,
-					    (int) receiver[i].diff.tv_usec,
+					    (int) receiver[i].diff,
 					    (int) ((receiver[i].sumdiff /
 					    receiver[i].samples) + 0.5),
 					    receiver[i].maxdiff);
@@ -695,15 +683,19 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (histogram) {
+		struct rt_hist *hist[num_threads];
+
+		for (i = 0; i < num_threads; i++)
+			hist[i] = rt_shm_slot(&shm, RT_SHM_HIST, i);
+		rt_hist_print(hist, num_threads, histogram);
+	}
+
 	nosem:
 	for (i = 0; i < num_threads; i++)
 		semctl(receiver[i].semid, -1, IPC_RMID);
 
- 	nomem:
-	if (mustfork) {
-		munmap(param, totalsize);
-		shm_unlink("/sigwaittest");
-	}
+	rt_shm_destroy(&shm);
 
 	return 0;
 }